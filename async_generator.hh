@@ -0,0 +1,163 @@
+#pragma once
+
+#include <coroutine>
+#include <exception>
+#include <memory>
+#include <type_traits>
+#include <utility>
+
+#include "lazy.hh"
+#include "trace.hh"
+
+// Coroutine streaming values to exactly one consumer without a channel: no
+// buffer, no lock, no waiter list. co_yield hands the consumer the address of
+// the value, which stays valid until it asks for the next one, and resumes it
+// by symmetric transfer; next() transfers back to the producer. The producer
+// may co_await anything in between, it is only resumed by next(). Frames are
+// allocated like std::lazy ones, an Allocator of frame_pool.hh works too.
+//
+//     auto lines(io_polling& io, int fd) -> async_generator<std::string>
+//     ...
+//     auto gen = lines(io, fd);
+//     while (auto* line = co_await gen.next())
+//
+// C++20 has no for co_await, the loop above is its spelling.
+template <typename Type, typename Allocator = void>
+class [[nodiscard]] async_generator
+{
+    static_assert(!std::is_reference_v<Type>, "values are already yielded by reference");
+
+public:
+    struct promise_type : public std::_Promise_allocator<Allocator>
+    {
+        auto get_return_object() noexcept -> async_generator
+        {
+            return async_generator{std::coroutine_handle<promise_type>::from_promise(*this)};
+        }
+
+        auto initial_suspend() noexcept -> std::suspend_always
+        {
+            return {};
+        }
+
+        // Run the consumer again, it reads value_ then calls next()
+        struct yield_awaiter
+        {
+            [[nodiscard]] auto await_ready() noexcept -> bool
+            {
+                return false;
+            }
+            auto await_suspend(std::coroutine_handle<promise_type> handle) noexcept
+                -> std::coroutine_handle<>
+            {
+                return handle.promise().consumer_;
+            }
+            void await_resume() noexcept
+            {}
+        };
+
+        // The value lives in the producer frame, or in the temporary of the
+        // co_yield expression which outlives the suspension
+        auto yield_value(Type& value) noexcept -> yield_awaiter
+        {
+            value_ = std::addressof(value);
+            return {};
+        }
+        auto yield_value(Type&& value) noexcept -> yield_awaiter
+        {
+            value_ = std::addressof(value);
+            return {};
+        }
+
+        void return_void() noexcept
+        {}
+
+        void unhandled_exception() noexcept
+        {
+            exception_ = std::current_exception();
+        }
+
+        struct final_awaiter
+        {
+            [[nodiscard]] auto await_ready() noexcept -> bool
+            {
+                return false;
+            }
+            auto await_suspend(std::coroutine_handle<promise_type> handle) noexcept
+                -> std::coroutine_handle<>
+            {
+                trace(trace_event::lazy_finish, handle.address(), handle.address());
+                return handle.promise().consumer_;
+            }
+            void await_resume() noexcept
+            {}
+        };
+        auto final_suspend() noexcept -> final_awaiter
+        {
+            value_ = nullptr;
+            return {};
+        }
+
+        Type* value_ = nullptr;
+        std::coroutine_handle<> consumer_{};
+        std::exception_ptr exception_{};
+    };
+
+    async_generator(async_generator&& other) noexcept
+        : coro_{std::exchange(other.coro_, nullptr)}
+    {}
+    auto operator=(async_generator&& other) noexcept -> async_generator&
+    {
+        std::swap(coro_, other.coro_);
+        return *this;
+    }
+
+    ~async_generator()
+    {
+        if (coro_)
+        {
+            coro_.destroy();
+        }
+    }
+
+    // Resumes with the next value, nullptr once the producer returned.
+    // Rethrows what escaped the producer.
+    struct async_next
+    {
+        [[nodiscard]] auto await_ready() noexcept -> bool
+        {
+            return coro_.done();
+        }
+        auto await_suspend(std::coroutine_handle<> consumer) noexcept -> std::coroutine_handle<>
+        {
+            auto& promise = coro_.promise();
+            if (!promise.consumer_)
+            {
+                trace(trace_event::lazy_start, coro_.address(), coro_.address());
+            }
+            promise.consumer_ = consumer;
+            return coro_;
+        }
+        auto await_resume() -> Type*
+        {
+            auto& promise = coro_.promise();
+            if (promise.exception_)
+            {
+                std::rethrow_exception(std::exchange(promise.exception_, nullptr));
+            }
+            return promise.value_;
+        }
+
+        std::coroutine_handle<promise_type> coro_;
+    };
+    auto next() -> async_next
+    {
+        return async_next{coro_};
+    }
+
+private:
+    explicit async_generator(std::coroutine_handle<promise_type> coro) noexcept : coro_{coro}
+    {}
+
+    std::coroutine_handle<promise_type> coro_;
+};
@@ -0,0 +1,557 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <coroutine>
+#include <cstddef>
+#include <cstdlib>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <new>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <tuple>
+#include <utility>
+#include <vector>
+
+#include "channel.hh"
+#include "executor.hh"
+#include "lazy.hh"
+#include "simple.hh"
+#include "slab_pool.hh"
+
+// Micro-benchmarks of simple.hh's channel against channel.hh's one, then of
+// 16KiB payloads moved as vectors or as slabs. Every workload runs single
+// threaded so that both implementations do the same work.
+//
+//     bench [--messages=N] [--repeat=R] [--json]
+//
+// --json prints one JSON object per result, for tracking regressions. Once
+// warm, channel.hh's implementations other than vector_16k have to run without
+// a single heap allocation, bench fails otherwise.
+
+namespace
+{
+std::atomic<std::size_t> allocations{0};
+} // namespace
+
+// Count every global heap allocation to report allocations per operation.
+// The over-aligned forms are left to the library, which pairs them itself:
+// only the channels of a run are over-aligned, never a per-message allocation.
+auto operator new(std::size_t size) -> void*
+{
+    allocations.fetch_add(1, std::memory_order_relaxed);
+    if (void* ptr = std::malloc(size == 0 ? 1 : size))
+    {
+        return ptr;
+    }
+    throw std::bad_alloc{};
+}
+
+void operator delete(void* ptr) noexcept
+{
+    std::free(ptr);
+}
+
+void operator delete(void* ptr, std::size_t /*size*/) noexcept
+{
+    std::free(ptr);
+}
+
+// simple::channel never resumes anybody: a task records the awaiter it is
+// blocked on and the driver resumes it once that awaiter is ready.
+struct polled_task
+{
+    struct promise_type
+    {
+        auto get_return_object() -> polled_task
+        {
+            return polled_task{std::coroutine_handle<promise_type>::from_promise(*this)};
+        }
+        auto initial_suspend() -> std::suspend_always
+        {
+            return {};
+        }
+        auto final_suspend() noexcept -> std::suspend_always
+        {
+            return {};
+        }
+        void return_void()
+        {}
+        void unhandled_exception()
+        {
+            std::terminate();
+        }
+
+        void* blocked_ = nullptr;
+        bool (*ready_)(void*) = nullptr;
+    };
+
+    explicit polled_task(std::coroutine_handle<promise_type> handle) : handle_{handle}
+    {}
+    polled_task(polled_task&& other) noexcept : handle_{std::exchange(other.handle_, nullptr)}
+    {}
+    polled_task(const polled_task&) = delete;
+    auto operator=(const polled_task&) -> polled_task& = delete;
+    auto operator=(polled_task&&) -> polled_task& = delete;
+
+    ~polled_task()
+    {
+        if (handle_)
+        {
+            handle_.destroy();
+        }
+    }
+
+    // Resume the task if it can make progress, false otherwise
+    auto step() -> bool
+    {
+        auto& promise = handle_.promise();
+        if (handle_.done() || (promise.blocked_ != nullptr && !promise.ready_(promise.blocked_)))
+        {
+            return false;
+        }
+        promise.blocked_ = nullptr;
+        handle_.resume();
+        return true;
+    }
+
+    [[nodiscard]] auto done() const -> bool
+    {
+        return handle_.done();
+    }
+
+    std::coroutine_handle<promise_type> handle_;
+};
+
+// A send queues its value as soon as it is created and its awaiter has no way
+// to tell when that value was taken, so a blocked send only yields once like in
+// simple.cpp's main
+template <typename Awaiter, bool Yield = false>
+struct polled
+{
+    [[nodiscard]] auto await_ready() -> bool
+    {
+        return awaiter_.await_ready();
+    }
+    void await_suspend(std::coroutine_handle<polled_task::promise_type> handle)
+    {
+        handle.promise().blocked_ = this;
+        handle.promise().ready_ = [](void* self) {
+            return Yield || static_cast<polled*>(self)->awaiter_.await_ready();
+        };
+    }
+    auto await_resume()
+    {
+        return awaiter_.await_resume();
+    }
+
+    Awaiter awaiter_;
+};
+
+struct simple_impl
+{
+    static constexpr std::string_view name = "simple";
+    // Sends queue their value whatever the buffer size, every new channel
+    // grows its ring under fan_out
+    static constexpr bool allocation_free = false;
+    using task = polled_task;
+    using channel = simple::channel<int>;
+
+    static auto recv(channel& chan)
+    {
+        return polled<channel::async_recv>{chan.recv()};
+    }
+    static auto send(channel& chan, int value)
+    {
+        return polled<channel::async_send, true>{chan.send(value)};
+    }
+
+    static void run(std::vector<task>& tasks)
+    {
+        while (!std::all_of(tasks.begin(), tasks.end(), std::mem_fn(&task::done)))
+        {
+            bool progress = false;
+            for (auto& task : tasks)
+            {
+                progress = task.step() || progress;
+            }
+            if (!progress)
+            {
+                throw std::runtime_error("simple: every task is blocked");
+            }
+        }
+    }
+};
+
+struct symmetric_impl
+{
+    static constexpr std::string_view name = "symmetric";
+    static constexpr bool allocation_free = true;
+    using task = std::lazy<void>;
+    using channel = ::channel<int>;
+
+    static auto recv(channel& chan)
+    {
+        return chan.recv();
+    }
+    static auto send(channel& chan, int value)
+    {
+        return chan.send(value);
+    }
+
+    static void run(std::vector<task>& tasks)
+    {
+        for (auto& task : tasks)
+        {
+            task.sync_await();
+        }
+        run_ready();
+    }
+};
+
+// symmetric_impl on the wait-free single producer single consumer ring, meant
+// for two threads: single threaded, its rows are the cost of its atomics
+struct spsc_impl : symmetric_impl
+{
+    static constexpr std::string_view name = "spsc";
+    using channel = ::channel<int, spsc>;
+
+    static auto recv(channel& chan)
+    {
+        return chan.recv();
+    }
+    static auto send(channel& chan, int value)
+    {
+        return chan.send(value);
+    }
+};
+
+inline constexpr std::size_t payload_size = 16 * 1024;
+
+// symmetric_impl moving 16KiB buffers, one heap allocation per message
+struct vector_impl : symmetric_impl
+{
+    static constexpr std::string_view name = "vector_16k";
+    static constexpr bool allocation_free = false;
+    using channel = ::channel<std::vector<std::byte>>;
+
+    static auto recv(channel& chan)
+    {
+        return chan.recv();
+    }
+    static auto send(channel& chan, int value)
+    {
+        std::vector<std::byte> payload(payload_size);
+        payload.front() = static_cast<std::byte>(value);
+        return chan.send(std::move(payload));
+    }
+};
+
+// symmetric_impl moving 16KiB slabs of a pool, no allocation per message
+struct slab_impl : symmetric_impl
+{
+    static constexpr std::string_view name = "slab_16k";
+    using channel = slab_channel<>;
+
+    static auto pool() -> slab_pool&
+    {
+        // Enough for the largest buffer plus the slabs held by both tasks
+        static slab_pool slabs{payload_size, 128};
+        return slabs;
+    }
+
+    static auto recv(channel& chan)
+    {
+        return chan.recv();
+    }
+    static auto send(channel& chan, int value)
+    {
+        auto payload = pool().try_acquire();
+        if (!payload)
+        {
+            throw std::runtime_error("slab pool exhausted");
+        }
+        payload.data().front() = static_cast<std::byte>(value);
+        payload.resize(payload_size);
+        return chan.send(std::move(payload));
+    }
+};
+
+template <typename Impl>
+auto sender(typename Impl::channel& chan, int count) -> typename Impl::task
+{
+    for (int i = 0; i < count; ++i)
+    {
+        co_await Impl::send(chan, i);
+    }
+}
+
+template <typename Impl>
+auto receiver(typename Impl::channel& chan, int count) -> typename Impl::task
+{
+    for (int i = 0; i < count; ++i)
+    {
+        auto&& [value, ok] = co_await Impl::recv(chan);
+        if (!ok)
+        {
+            break;
+        }
+    }
+}
+
+template <typename Impl>
+auto pinger(typename Impl::channel& ping, typename Impl::channel& pong, int count) ->
+    typename Impl::task
+{
+    for (int i = 0; i < count; ++i)
+    {
+        co_await Impl::send(ping, i);
+        co_await Impl::recv(pong);
+    }
+}
+
+template <typename Impl>
+auto ponger(typename Impl::channel& ping, typename Impl::channel& pong, int count) ->
+    typename Impl::task
+{
+    for (int i = 0; i < count; ++i)
+    {
+        auto&& [value, ok] = co_await Impl::recv(ping);
+        co_await Impl::send(pong, value);
+    }
+}
+
+template <typename Impl>
+auto stage(typename Impl::channel& in, typename Impl::channel& out, int count) ->
+    typename Impl::task
+{
+    for (int i = 0; i < count; ++i)
+    {
+        auto&& [value, ok] = co_await Impl::recv(in);
+        co_await Impl::send(out, value + 1);
+    }
+}
+
+// Channels and tasks of one run, the channels outlive the tasks using them
+template <typename Impl>
+struct workload
+{
+    std::vector<std::unique_ptr<typename Impl::channel>> channels_{};
+    std::vector<typename Impl::task> tasks_{};
+
+    auto make_channel(std::size_t buffer_size = 0) -> typename Impl::channel&
+    {
+        return *channels_.emplace_back(std::make_unique<typename Impl::channel>(buffer_size));
+    }
+};
+
+template <typename Impl>
+void ping_pong(workload<Impl>& work, int messages, int /*param*/)
+{
+    auto& ping = work.make_channel();
+    auto& pong = work.make_channel();
+    work.tasks_.push_back(pinger<Impl>(ping, pong, messages));
+    work.tasks_.push_back(ponger<Impl>(ping, pong, messages));
+}
+
+template <typename Impl>
+void buffered(workload<Impl>& work, int messages, int buffer_size)
+{
+    auto& chan = work.make_channel(static_cast<std::size_t>(buffer_size));
+    work.tasks_.push_back(receiver<Impl>(chan, messages));
+    work.tasks_.push_back(sender<Impl>(chan, messages));
+}
+
+template <typename Impl>
+void fan_out(workload<Impl>& work, int messages, int receivers)
+{
+    auto& chan = work.make_channel();
+    for (int i = 0; i < receivers; ++i)
+    {
+        work.tasks_.push_back(receiver<Impl>(chan, messages / receivers));
+    }
+    work.tasks_.push_back(sender<Impl>(chan, messages / receivers * receivers));
+}
+
+template <typename Impl>
+void fan_in(workload<Impl>& work, int messages, int senders)
+{
+    auto& chan = work.make_channel();
+    work.tasks_.push_back(receiver<Impl>(chan, messages / senders * senders));
+    for (int i = 0; i < senders; ++i)
+    {
+        work.tasks_.push_back(sender<Impl>(chan, messages / senders));
+    }
+}
+
+template <typename Impl>
+void pipeline(workload<Impl>& work, int messages, int depth)
+{
+    std::vector<typename Impl::channel*> chans{};
+    for (int i = 0; i <= depth; ++i)
+    {
+        chans.push_back(&work.make_channel());
+    }
+    work.tasks_.push_back(receiver<Impl>(*chans.back(), messages));
+    for (int i = 0; i < depth; ++i)
+    {
+        work.tasks_.push_back(stage<Impl>(*chans[i], *chans[i + 1], messages));
+    }
+    work.tasks_.push_back(sender<Impl>(*chans.front(), messages));
+}
+
+struct options
+{
+    int messages = 100000;
+    int repeat = 5;
+    bool json = false;
+};
+
+struct result
+{
+    std::string_view impl;
+    std::string_view workload;
+    int param;
+    int messages;
+    double ns_per_op;
+    double allocs_per_op;
+    double msgs_per_s;
+};
+
+void report(const result& res, const options& opts)
+{
+    if (opts.json)
+    {
+        std::cout << "{\"impl\":\"" << res.impl << "\",\"workload\":\"" << res.workload
+                  << "\",\"param\":" << res.param << ",\"messages\":" << res.messages
+                  << ",\"ns_per_op\":" << res.ns_per_op << ",\"allocs_per_op\":" << res.allocs_per_op
+                  << ",\"msgs_per_s\":" << res.msgs_per_s << "}\n";
+        return;
+    }
+    std::cout << res.impl << "\t" << res.workload << "/" << res.param << "\t" << res.ns_per_op
+              << " ns/op\t" << res.allocs_per_op << " allocs/op\t" << res.msgs_per_s
+              << " msgs/s\n";
+}
+
+// Best of opts.repeat runs. Allocations are counted while the tasks run, not
+// while building them, and the first run warms up the thread's ready queue.
+template <typename Impl, typename Setup>
+void measure(std::string_view name, Setup setup, int param, const options& opts)
+{
+    result best{Impl::name, name, param, opts.messages, 0, 0, 0};
+    for (int i = 0; i < opts.repeat; ++i)
+    {
+        std::size_t allocs = 0;
+        const auto start = std::chrono::steady_clock::now();
+        {
+            workload<Impl> work{};
+            work.tasks_.reserve(static_cast<std::size_t>(param) + 2);
+            setup(work, opts.messages, param);
+            const auto allocs_before = allocations.load(std::memory_order_relaxed);
+            Impl::run(work.tasks_);
+            allocs = allocations.load(std::memory_order_relaxed) - allocs_before;
+        }
+        const auto elapsed = std::chrono::duration<double, std::nano>(
+                                 std::chrono::steady_clock::now() - start)
+                                 .count();
+        if (Impl::allocation_free && i > 0 && allocs != 0)
+        {
+            throw std::runtime_error(std::string{Impl::name} + " " + std::string{name} + "/" +
+                                     std::to_string(param) + ": " + std::to_string(allocs) +
+                                     " heap allocations once warm");
+        }
+        const double ns_per_op = elapsed / opts.messages;
+        if (i == 0 || ns_per_op < best.ns_per_op)
+        {
+            best.ns_per_op = ns_per_op;
+            best.allocs_per_op = static_cast<double>(allocs) / opts.messages;
+            best.msgs_per_s = 1e9 / ns_per_op;
+        }
+    }
+    report(best, opts);
+}
+
+template <typename Impl>
+void run_all(const options& opts)
+{
+    measure<Impl>("ping_pong", ping_pong<Impl>, 0, opts);
+    // Mirrors buff0..buff4 of go/channel.go, plus a large buffer
+    for (const int buffer_size : {0, 1, 2, 4, 64})
+    {
+        measure<Impl>("buffered", buffered<Impl>, buffer_size, opts);
+    }
+    measure<Impl>("fan_out", fan_out<Impl>, 4, opts);
+    measure<Impl>("fan_in", fan_in<Impl>, 4, opts);
+    measure<Impl>("pipeline", pipeline<Impl>, 4, opts);
+}
+
+// Workloads where every channel has one sender and one receiver
+template <typename Impl>
+void run_one_to_one(const options& opts)
+{
+    measure<Impl>("ping_pong", ping_pong<Impl>, 0, opts);
+    for (const int buffer_size : {0, 1, 2, 4, 64})
+    {
+        measure<Impl>("buffered", buffered<Impl>, buffer_size, opts);
+    }
+    measure<Impl>("pipeline", pipeline<Impl>, 4, opts);
+}
+
+// ping_pong and pipeline compute on the received value, payloads only go
+// through the buffered workloads
+template <typename Impl>
+void run_payloads(const options& opts)
+{
+    for (const int buffer_size : {0, 64})
+    {
+        measure<Impl>("buffered", buffered<Impl>, buffer_size, opts);
+    }
+}
+
+auto parse(int argc, char** argv) -> options
+{
+    options opts{};
+    for (int i = 1; i < argc; ++i)
+    {
+        const std::string_view arg{argv[i]};
+        if (arg == "--json")
+        {
+            opts.json = true;
+        }
+        else if (arg.starts_with("--messages="))
+        {
+            opts.messages = std::stoi(std::string{arg.substr(arg.find('=') + 1)});
+        }
+        else if (arg.starts_with("--repeat="))
+        {
+            opts.repeat = std::stoi(std::string{arg.substr(arg.find('=') + 1)});
+        }
+        else
+        {
+            throw std::invalid_argument("usage: bench [--messages=N] [--repeat=R] [--json]");
+        }
+    }
+    opts.messages = std::max(opts.messages, 1);
+    opts.repeat = std::max(opts.repeat, 1);
+    return opts;
+}
+
+auto main(int argc, char** argv) -> int
+{
+    try
+    {
+        const auto opts = parse(argc, argv);
+        run_all<simple_impl>(opts);
+        run_all<symmetric_impl>(opts);
+        run_one_to_one<spsc_impl>(opts);
+        run_payloads<vector_impl>(opts);
+        run_payloads<slab_impl>(opts);
+    }
+    catch (const std::exception& error)
+    {
+        std::cerr << error.what() << "\n";
+        return 1;
+    }
+}
@@ -0,0 +1,365 @@
+#pragma once
+
+#include <algorithm>
+#include <bit>
+#include <cassert>
+#include <coroutine>
+#include <cstddef>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "channel.hh"
+#include "executor.hh"
+#include "trace.hh"
+
+// What a publisher does when the slowest subscriber is a whole ring behind
+enum class lag_policy
+{
+    // Park the publisher until every subscriber read the oldest value
+    backpressure,
+    // Overwrite the oldest value, a subscriber behind skips what it missed
+    drop_oldest,
+};
+
+// Every subscriber receives every value, like a Disruptor: values are written
+// once in a ring and each subscriber reads it through its own cursor instead
+// of the value being cloned into one channel per subscriber. A subscriber
+// parks once it caught up with the publishers and copies each value out when
+// it resumes, after releasing the lock with backpressure since the slot
+// cannot be overwritten before its cursor moves. Policy picks the lock like
+// for channel.
+//
+//     broadcast<config> updates{16};
+//     auto sub = updates.subscribe();
+//     while (auto update = co_await sub.recv())
+template <typename Type, typename Policy = single_thread>
+class broadcast
+{
+public:
+    using lock_type = typename Policy::lock_type;
+
+    explicit broadcast(std::size_t capacity, lag_policy lag = lag_policy::backpressure)
+        : capacity_{std::bit_ceil(std::max<std::size_t>(capacity, 1))}
+        , lag_{lag}
+        , slots_{allocator_.allocate(capacity_)}
+    {}
+
+    broadcast(const broadcast&) = delete;
+    auto operator=(const broadcast&) -> broadcast& = delete;
+
+    // Subscribers and parked publishers must be gone
+    ~broadcast()
+    {
+        assert(subscribers_.empty() && "a subscriber outlives its broadcast");
+        for (auto seq = oldest(); seq != tail_; ++seq)
+        {
+            std::destroy_at(slot(seq));
+        }
+        allocator_.deallocate(slots_, capacity_);
+    }
+
+    // Cursor of one subscriber, it unsubscribes when destroyed
+    class subscriber
+    {
+    public:
+        subscriber(const subscriber&) = delete;
+        auto operator=(const subscriber&) -> subscriber& = delete;
+
+        ~subscriber()
+        {
+            bus_.unsubscribe(*this);
+        }
+
+        // Resumes with the next value, or with nothing once the broadcast is
+        // closed and every value was read
+        struct async_recv
+        {
+            [[nodiscard]] auto await_ready() -> bool
+            {
+                auto& bus = sub_.bus_;
+                std::lock_guard lock{bus.lock_};
+                return bus.take(sub_, data_, reading_) || bus.closed_;
+            }
+            auto await_suspend(std::coroutine_handle<> handle) -> std::coroutine_handle<>
+            {
+                auto& bus = sub_.bus_;
+                std::lock_guard lock{bus.lock_};
+                if (bus.take(sub_, data_, reading_) || bus.closed_)
+                {
+                    return handle;
+                }
+                sub_.handle_ = handle;
+                sub_.parked_ = true;
+                ++bus.parked_;
+                trace(trace_event::park, &bus, handle.address());
+                return next_ready();
+            }
+            auto await_resume() -> std::optional<Type>
+            {
+                auto& bus = sub_.bus_;
+                if (!data_ && reading_ == nullptr)
+                {
+                    std::lock_guard lock{bus.lock_};
+                    bus.take(sub_, data_, reading_);
+                }
+                if (reading_ != nullptr)
+                {
+                    data_.emplace(*reading_);
+                    std::lock_guard lock{bus.lock_};
+                    bus.commit(sub_);
+                }
+                return std::move(data_);
+            }
+
+            subscriber& sub_;
+            std::optional<Type> data_{};
+            // Slot to copy without the lock, its cursor moves once copied
+            const Type* reading_ = nullptr;
+        };
+        auto recv() -> async_recv
+        {
+            return async_recv{*this};
+        }
+
+        // Values skipped because the subscriber fell a whole ring behind a
+        // drop_oldest broadcast
+        [[nodiscard]] auto missed() const -> std::size_t
+        {
+            std::lock_guard lock{bus_.lock_};
+            return missed_;
+        }
+
+    private:
+        friend class broadcast;
+
+        explicit subscriber(broadcast& bus) : bus_{bus}
+        {
+            std::lock_guard lock{bus_.lock_};
+            cursor_ = bus_.tail_;
+            bus_.subscribers_.push_back(this);
+        }
+
+        broadcast& bus_;
+        // Sequence of the next value to read
+        std::size_t cursor_ = 0;
+        std::size_t missed_ = 0;
+        std::coroutine_handle<> handle_{};
+        bool parked_ = false;
+    };
+
+    // The subscriber sees the values published after this call
+    auto subscribe() -> subscriber
+    {
+        return subscriber{*this};
+    }
+
+    // Resumes with false when the broadcast was closed before the value could
+    // be written
+    struct async_send : public IntrusiveNode<async_send>
+    {
+        [[nodiscard]] auto await_ready() -> bool
+        {
+            std::lock_guard lock{bus_.lock_};
+            return bus_.closed_ || bus_.try_write(*this);
+        }
+        auto await_suspend(std::coroutine_handle<> handle) -> std::coroutine_handle<>
+        {
+            std::lock_guard lock{bus_.lock_};
+            if (bus_.closed_ || bus_.try_write(*this))
+            {
+                return handle;
+            }
+            handle_ = handle;
+            bus_.publishers_.push(this);
+            trace(trace_event::park, &bus_, handle.address());
+            return next_ready();
+        }
+        [[nodiscard]] auto await_resume() const -> bool
+        {
+            return sent_;
+        }
+
+        broadcast& bus_;
+        Type data_;
+        std::coroutine_handle<> handle_{};
+        bool sent_ = false;
+    };
+    auto send(Type value) -> async_send
+    {
+        return async_send{{}, *this, std::move(value)};
+    }
+
+    // Publish without waiting. False when the ring is full for a subscriber
+    // with backpressure, or the broadcast is closed.
+    auto try_send(Type value) -> bool
+    {
+        async_send send{{}, *this, std::move(value)};
+        std::lock_guard lock{lock_};
+        return !closed_ && try_write(send);
+    }
+
+    // Wake every parked subscriber and publisher, values already published
+    // can still be received
+    void close()
+    {
+        std::lock_guard lock{lock_};
+        if (std::exchange(closed_, true))
+        {
+            return;
+        }
+        trace(trace_event::close, this);
+        wake_subscribers();
+        while (auto* send = publishers_.pop())
+        {
+            schedule(send->handle_);
+        }
+    }
+
+    [[nodiscard]] auto closed() const -> bool
+    {
+        std::lock_guard lock{lock_};
+        return closed_;
+    }
+
+private:
+    auto slot(std::size_t seq) -> Type*
+    {
+        return &slots_[seq & (capacity_ - 1)];
+    }
+
+    // Sequence of the oldest value still in the ring
+    [[nodiscard]] auto oldest() const -> std::size_t
+    {
+        return tail_ > capacity_ ? tail_ - capacity_ : 0;
+    }
+
+    // Lock must be held. The slowest cursor is only looked for when the ring
+    // looks full from the one found last time.
+    auto full() -> bool
+    {
+        if (lag_ == lag_policy::drop_oldest || tail_ - gate_ < capacity_)
+        {
+            return false;
+        }
+        gate_ = tail_;
+        for (const auto* sub : subscribers_)
+        {
+            gate_ = std::min(gate_, sub->cursor_);
+        }
+        return tail_ - gate_ >= capacity_;
+    }
+
+    // Lock must be held
+    auto try_write(async_send& send) -> bool
+    {
+        if (full())
+        {
+            return false;
+        }
+        auto* value = slot(tail_);
+        if (tail_ >= capacity_)
+        {
+            std::destroy_at(value);
+        }
+        std::construct_at(value, std::move(send.data_));
+        ++tail_;
+        send.sent_ = true;
+        wake_subscribers();
+        return true;
+    }
+
+    // Copy the next value of the subscriber out, lock must be held. With
+    // backpressure a value dearer to copy than a couple of words is only
+    // pointed to by reading, to be copied once the lock is released and then
+    // committed: publishers cannot reuse the slot before the cursor moves.
+    auto take(subscriber& sub, std::optional<Type>& out, const Type*& reading) -> bool
+    {
+        if (sub.cursor_ == tail_)
+        {
+            return false;
+        }
+        if (sub.cursor_ < oldest())
+        {
+            sub.missed_ += oldest() - sub.cursor_;
+            sub.cursor_ = oldest();
+        }
+        if (lag_ == lag_policy::backpressure && !cheap_copy)
+        {
+            reading = slot(sub.cursor_);
+            return true;
+        }
+        out.emplace(*slot(sub.cursor_));
+        commit(sub);
+        return true;
+    }
+
+    // The subscriber is done with the value at its cursor, lock must be held
+    void commit(subscriber& sub)
+    {
+        ++sub.cursor_;
+        refill();
+    }
+
+    // Parked publishers write as long as the slowest subscriber leaves room
+    void refill()
+    {
+        while (!publishers_.empty() && !full())
+        {
+            auto* send = publishers_.pop();
+            try_write(*send);
+            trace(trace_event::wake, this, send->handle_.address());
+            schedule(send->handle_);
+        }
+    }
+
+    void wake_subscribers()
+    {
+        if (parked_ == 0)
+        {
+            return;
+        }
+        for (auto* sub : subscribers_)
+        {
+            if (std::exchange(sub->parked_, false))
+            {
+                trace(trace_event::wake, this, sub->handle_.address());
+                schedule(sub->handle_);
+            }
+        }
+        parked_ = 0;
+    }
+
+    void unsubscribe(subscriber& sub)
+    {
+        std::lock_guard lock{lock_};
+        std::erase(subscribers_, &sub);
+        if (sub.parked_)
+        {
+            --parked_;
+        }
+        // It may have been the slowest one
+        gate_ = 0;
+        refill();
+    }
+
+    static constexpr bool cheap_copy =
+        std::is_trivially_copyable_v<Type> && sizeof(Type) <= 2 * sizeof(void*);
+
+    const std::size_t capacity_;
+    const lag_policy lag_;
+    [[no_unique_address]] std::allocator<Type> allocator_{};
+    Type* const slots_;
+    // Sequence of the next value published
+    std::size_t tail_ = 0;
+    // No subscriber cursor is behind it
+    std::size_t gate_ = 0;
+    std::vector<subscriber*> subscribers_{};
+    std::size_t parked_ = 0;
+    FIFOList<async_send> publishers_{};
+    bool closed_ = false;
+    mutable lock_type lock_{};
+};
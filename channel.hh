@@ -0,0 +1,1533 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <cassert>
+#include <coroutine>
+#include <cstddef>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <span>
+#include <stdexcept>
+#include <stop_token>
+#include <tuple>
+#include <utility>
+
+#include "executor.hh"
+#include "ring_buffer.hh"
+#include "spinlock.hh"
+#include "timer_wheel.hh"
+#include "trace.hh"
+
+template <typename Derived>
+class IntrusiveNode
+{
+public:
+    Derived* next = nullptr;
+    Derived* prev = nullptr;
+};
+
+// Intrusive doubly linked FIFO, a node may be unlinked from anywhere in O(1)
+template <typename T>
+class FIFOList
+{
+public:
+    FIFOList() : head(nullptr), tail(nullptr)
+    {}
+
+    void push(T* newNode)
+    {
+        newNode->next = nullptr;
+        newNode->prev = tail;
+        if (tail == nullptr)
+        {
+            head = newNode;
+        }
+        else
+        {
+            tail->next = newNode;
+        }
+        tail = newNode;
+    }
+
+    void push_front(T* newNode)
+    {
+        newNode->prev = nullptr;
+        newNode->next = head;
+        if (head == nullptr)
+        {
+            tail = newNode;
+        }
+        else
+        {
+            head->prev = newNode;
+        }
+        head = newNode;
+    }
+
+    auto pop() -> T*
+    {
+        if (head == nullptr)
+        {
+            return nullptr;
+        }
+
+        T* elem = head;
+        head = head->next;
+        if (head == nullptr)
+        {
+            // The list becomes empty after the pop
+            tail = nullptr;
+        }
+        else
+        {
+            head->prev = nullptr;
+        }
+        elem->next = nullptr;
+        return elem;
+    }
+
+    // Unlink an element from anywhere in the list, false when it is not there.
+    // A node is only ever linked in this list, so having no predecessor while
+    // not being the head means it was popped already.
+    auto remove(T* elem) -> bool
+    {
+        if (elem->prev == nullptr && head != elem)
+        {
+            return false;
+        }
+        (elem->prev == nullptr ? head : elem->prev->next) = elem->next;
+        (elem->next == nullptr ? tail : elem->next->prev) = elem->prev;
+        elem->prev = nullptr;
+        elem->next = nullptr;
+        return true;
+    }
+
+    [[nodiscard]] auto empty() const -> bool
+    {
+        return head == nullptr;
+    }
+
+private:
+    T* head;
+    T* tail;
+};
+
+// Shared by the waiters a select parks on each of its channels, the first
+// channel claiming one of them completes the select.
+class select_state
+{
+public:
+    static constexpr std::size_t none = static_cast<std::size_t>(-1);
+
+    auto claim(std::size_t index) -> bool
+    {
+        std::size_t expected = none;
+        return winner_.compare_exchange_strong(expected, index, std::memory_order_acq_rel);
+    }
+
+    [[nodiscard]] auto winner() const -> std::size_t
+    {
+        return winner_.load(std::memory_order_acquire);
+    }
+
+private:
+    std::atomic<std::size_t> winner_{none};
+};
+
+template <typename Derived>
+struct waiter : public IntrusiveNode<Derived>
+{
+    // A waiter parked by a select may only be completed once a channel won it
+    auto claim() -> bool
+    {
+        return select_ == nullptr || select_->claim(case_);
+    }
+
+    std::coroutine_handle<> handle_{};
+    select_state* select_ = nullptr;
+    std::size_t case_ = 0;
+};
+
+// Timer of a recv/send with a deadline. The parked waiter and the timer race on
+// a select_state of their own: the channel completes case 0, the timer claims
+// timed_out and reschedules the coroutine, which then unlinks its waiter.
+struct deadline_timer : public timer_wheel::entry
+{
+    static constexpr std::size_t timed_out = 1;
+
+    explicit deadline_timer(timer_wheel::clock::time_point deadline) : deadline_{deadline}
+    {
+        this->fire_ = &fire;
+    }
+
+    deadline_timer(const deadline_timer&) = delete;
+    auto operator=(const deadline_timer&) -> deadline_timer& = delete;
+
+    // Must be the last use of the awaiter in await_suspend, the coroutine may
+    // be resumed by another thread as soon as the timer is armed
+    void arm(std::coroutine_handle<> handle)
+    {
+        handle_ = handle;
+        wheel_ = &timers();
+        wheel_->arm(*this, deadline_);
+    }
+
+    // True when the deadline won. Either way the timer is done with the
+    // awaiter once this returns.
+    auto expired() -> bool
+    {
+        const bool expired = state_.winner() == timed_out;
+        if (wheel_ != nullptr)
+        {
+            wheel_->cancel(*this);
+        }
+        return expired;
+    }
+
+    static void fire(timer_wheel::entry& entry)
+    {
+        auto& self = static_cast<deadline_timer&>(entry);
+        if (self.state_.claim(timed_out))
+        {
+            schedule(self.handle_);
+        }
+    }
+
+    timer_wheel::clock::time_point deadline_;
+    select_state state_{};
+    std::coroutine_handle<> handle_{};
+    timer_wheel* wheel_ = nullptr;
+};
+
+// Cancellation of a parked recv/send by a std::stop_token. Like deadline_timer
+// the stop callback races with the channel on a select_state of its own and
+// reschedules the coroutine, which then unlinks its waiter in O(1). The
+// coroutine goes back to the executor it parked on, any thread may request the
+// stop; without an executor it must be the thread running the coroutine.
+struct stop_waiter
+{
+    static constexpr std::size_t stopped = 1;
+
+    explicit stop_waiter(std::stop_token token) : token_{std::move(token)}
+    {}
+
+    // A stop requested before parking wins right away
+    auto stop_requested() -> bool
+    {
+        return token_.stop_requested() && state_.claim(stopped);
+    }
+
+    // Called with the channel lock held, as the last use of the awaiter in
+    // await_suspend: a callback running right away reschedules the coroutine,
+    // whose await_resume has to take that lock before touching the awaiter
+    void arm(std::coroutine_handle<> handle)
+    {
+        handle_ = handle;
+        executor_ = executor::current();
+        callback_.emplace(token_, wake{this});
+    }
+
+    // True when the stop request won. Either way the callback is done with the
+    // awaiter once this returns.
+    auto cancelled() -> bool
+    {
+        callback_.reset();
+        return state_.winner() == stopped;
+    }
+
+    struct wake
+    {
+        void operator()() const
+        {
+            if (!self_->state_.claim(stopped))
+            {
+                return;
+            }
+            if (self_->executor_ != nullptr)
+            {
+                self_->executor_->schedule(self_->handle_);
+            }
+            else
+            {
+                schedule(self_->handle_);
+            }
+        }
+
+        stop_waiter* self_;
+    };
+
+    std::stop_token token_;
+    select_state state_{};
+    std::coroutine_handle<> handle_{};
+    executor* executor_ = nullptr;
+    std::optional<std::stop_callback<wake>> callback_{};
+};
+
+// Every coroutine using the channel lives on the same thread, or on an
+// executor with a single worker.
+struct single_thread
+{
+    using lock_type = null_lock;
+    template <typename Type>
+    using buffer_type = ring_buffer<Type>;
+};
+
+// Any number of producer and consumer threads. A waiter is matched with its
+// peer under a short spinlock critical section and the peer is resumed once
+// the lock has been released.
+struct mpmc
+{
+    using lock_type = spinlock;
+    template <typename Type>
+    using buffer_type = ring_buffer<Type>;
+};
+
+// Buffer of Size values stored inside the channel, with the locking of
+// Policy. The channel never allocates, so a short lived one can live in a
+// coroutine frame or on the stack.
+template <std::size_t Size, typename Policy = single_thread>
+struct inline_buffer
+{
+    static_assert(Size > 0, "an unbuffered channel allocates nothing already");
+
+    using lock_type = typename Policy::lock_type;
+    // The ring is rounded up to a power of two, the channel still holds Size
+    template <typename Type>
+    using buffer_type = inline_ring_buffer<Type, std::bit_ceil(Size)>;
+    static constexpr std::size_t buffer_size = Size;
+};
+
+// Exactly one producer and one consumer coroutine running on different
+// threads, typically two workers of an executor. Values go through a
+// wait-free ring instead of the waiter lists, see the channel<Type, spsc>
+// specialization. Its atomics only pay off across threads: when both sides
+// share a thread the default channel is faster.
+struct spsc
+{};
+
+template <typename Type, typename Policy = single_thread>
+class channel
+{
+public:
+    using lock_type = typename Policy::lock_type;
+    using buffer_type = typename Policy::template buffer_type<Type>;
+
+    channel(std::size_t buffer_size = 0)
+        requires(!requires { Policy::buffer_size; })
+        : buffer_size_{buffer_size}, fifo_{buffer_size}
+    {}
+    // The size is part of an inline_buffer policy
+    channel()
+        requires requires { Policy::buffer_size; }
+        : buffer_size_{Policy::buffer_size}
+    {}
+    struct async_recv : public waiter<async_recv>
+    {
+        async_recv(channel& channel) : channel_{channel}
+        {}
+        async_recv(channel& channel, std::span<Type> many) : channel_{channel}, many_{many}
+        {}
+
+        [[nodiscard]] auto await_ready() -> bool
+        {
+            std::lock_guard lock{channel_.lock_};
+            return channel_.recv_ready(*this);
+        }
+        auto await_suspend(std::coroutine_handle<> handle) -> std::coroutine_handle<>
+        {
+            std::lock_guard lock{channel_.lock_};
+            this->handle_ = handle;
+            wakeups wake{};
+            if (channel_.exchange(*this, wake))
+            {
+                return wake.finish(handle);
+            }
+            channel_.receivers_.push(this);
+            trace(trace_event::park, &channel_, handle.address());
+            return wake.park();
+        }
+        auto await_resume()
+        {
+            if (data_)
+            {
+                return std::make_tuple(std::move(*data_), true);
+            }
+            if (!channel_.closed())
+            {
+                throw std::runtime_error("unexpected await resume");
+            }
+            return std::make_tuple(Type{}, false);
+        }
+
+        // Used by select with the channel lock held
+        auto select_lock() -> lock_type*
+        {
+            return &channel_.lock_;
+        }
+        auto select_try(std::coroutine_handle<> handle) -> std::coroutine_handle<>
+        {
+            this->handle_ = handle;
+            wakeups wake{};
+            return channel_.exchange(*this, wake) ? wake.finish(handle) : nullptr;
+        }
+        void select_park(select_state& state, std::size_t index, std::coroutine_handle<> handle)
+        {
+            this->handle_ = handle;
+            this->select_ = &state;
+            this->case_ = index;
+            channel_.receivers_.push(this);
+            trace(trace_event::park, &channel_, handle.address());
+        }
+        void select_unpark()
+        {
+            channel_.receivers_.remove(this);
+        }
+
+        // Number of values this receiver still accepts
+        [[nodiscard]] auto room() const -> std::size_t
+        {
+            return many_.empty() ? static_cast<std::size_t>(!data_) : many_.size() - count_;
+        }
+        [[nodiscard]] auto received() const -> std::size_t
+        {
+            return many_.empty() ? static_cast<std::size_t>(data_.has_value()) : count_;
+        }
+        void deliver(Type* first, std::size_t count)
+        {
+            if (many_.empty())
+            {
+                data_.emplace(std::move(*first));
+                return;
+            }
+            std::move(first, first + count, many_.data() + count_);
+            count_ += count;
+        }
+        void deliver(buffer_type& fifo, std::size_t count)
+        {
+            if (many_.empty())
+            {
+                data_.emplace(std::move(fifo.front()));
+                fifo.pop_front();
+                return;
+            }
+            fifo.move_front(many_.data() + count_, count);
+            count_ += count;
+        }
+
+        channel& channel_;
+        std::optional<Type> data_{};
+        // Destination of recv_many, empty for a single recv
+        std::span<Type> many_{};
+        std::size_t count_ = 0;
+    };
+    auto recv() -> async_recv
+    {
+        return async_recv{*this};
+    }
+
+    // Receive like recv() but give up at the deadline. Resumes with no value
+    // when the deadline passed, otherwise with what recv() would return.
+    struct async_recv_until : public async_recv
+    {
+        async_recv_until(channel& channel, timer_wheel::clock::time_point deadline)
+            : async_recv{channel}, timer_{deadline}
+        {}
+
+        auto await_suspend(std::coroutine_handle<> handle) -> std::coroutine_handle<>
+        {
+            auto& chan = this->channel_;
+            std::lock_guard lock{chan.lock_};
+            this->handle_ = handle;
+            wakeups wake{};
+            if (chan.exchange(*this, wake))
+            {
+                return wake.finish(handle);
+            }
+            this->select_ = &timer_.state_;
+            chan.receivers_.push(this);
+            trace(trace_event::park, &chan, handle.address());
+            timer_.arm(handle);
+            return wake.park();
+        }
+        auto await_resume() -> std::optional<std::tuple<Type, bool>>
+        {
+            if (timer_.expired())
+            {
+                std::lock_guard lock{this->channel_.lock_};
+                this->channel_.receivers_.remove(this);
+                return std::nullopt;
+            }
+            return async_recv::await_resume();
+        }
+
+        deadline_timer timer_;
+    };
+    auto recv_until(timer_wheel::clock::time_point deadline) -> async_recv_until
+    {
+        return async_recv_until{*this, deadline};
+    }
+    auto recv_for(timer_wheel::clock::duration timeout) -> async_recv_until
+    {
+        return async_recv_until{*this, timer_wheel::clock::now() + timeout};
+    }
+
+    // Receive like recv() until a stop is requested on the token. Resumes with
+    // no value when cancelled, otherwise with what recv() would return.
+    struct async_recv_stoppable : public async_recv
+    {
+        async_recv_stoppable(channel& channel, std::stop_token token)
+            : async_recv{channel}, stop_{std::move(token)}
+        {}
+
+        [[nodiscard]] auto await_ready() -> bool
+        {
+            return stop_.stop_requested() || async_recv::await_ready();
+        }
+        auto await_suspend(std::coroutine_handle<> handle) -> std::coroutine_handle<>
+        {
+            auto& chan = this->channel_;
+            std::lock_guard lock{chan.lock_};
+            this->handle_ = handle;
+            wakeups wake{};
+            if (chan.exchange(*this, wake))
+            {
+                return wake.finish(handle);
+            }
+            this->select_ = &stop_.state_;
+            chan.receivers_.push(this);
+            trace(trace_event::park, &chan, handle.address());
+            stop_.arm(handle);
+            return wake.park();
+        }
+        auto await_resume() -> std::optional<std::tuple<Type, bool>>
+        {
+            {
+                std::lock_guard lock{this->channel_.lock_};
+                if (stop_.cancelled())
+                {
+                    this->channel_.receivers_.remove(this);
+                    return std::nullopt;
+                }
+            }
+            return async_recv::await_resume();
+        }
+
+        stop_waiter stop_;
+    };
+    auto recv(std::stop_token token) -> async_recv_stoppable
+    {
+        return async_recv_stoppable{*this, std::move(token)};
+    }
+
+    // Receive at least one value and at most out.size(), parking at most once.
+    // Resumes with the number of values received, 0 once the channel is closed.
+    struct async_recv_many : public async_recv
+    {
+        async_recv_many(channel& channel, std::span<Type> out) : async_recv{channel, out}
+        {
+            assert(!out.empty() && "recv_many needs room for at least one value");
+        }
+
+        auto await_resume() -> std::size_t
+        {
+            return this->count_;
+        }
+    };
+    auto recv_many(std::span<Type> out) -> async_recv_many
+    {
+        return async_recv_many{*this, out};
+    }
+    auto recv_many(std::span<Type> out, std::size_t max) -> async_recv_many
+    {
+        return async_recv_many{*this, out.first(std::min(max, out.size()))};
+    }
+
+    // Receive like recv() but resume with the value, or with nothing once the
+    // channel is closed: no default constructed Type, no tuple to move through
+    struct async_recv_optional : public async_recv
+    {
+        using async_recv::async_recv;
+
+        auto await_resume() -> std::optional<Type>
+        {
+            return std::move(this->data_);
+        }
+    };
+    auto recv_optional() -> async_recv_optional
+    {
+        return async_recv_optional{*this};
+    }
+
+    // Resumes with true once the value was handed to a receiver or buffered,
+    // false when the channel was closed first and the value dropped
+    struct async_send : public waiter<async_send>
+    {
+        async_send(channel& channel, Type&& data) : channel_{channel}, data_{std::move(data)}
+        {}
+        template <typename... Args>
+        async_send(channel& channel, std::in_place_t, Args&&... args)
+            : channel_{channel}, data_{std::in_place, std::forward<Args>(args)...}
+        {}
+        async_send(channel& channel, std::span<Type> many) : channel_{channel}, many_{many}
+        {}
+
+        auto await_ready() -> bool
+        {
+            std::lock_guard lock{channel_.lock_};
+            return channel_.send_ready(*this);
+        }
+        auto await_suspend(std::coroutine_handle<> handle) -> std::coroutine_handle<>
+        {
+            std::lock_guard lock{channel_.lock_};
+            this->handle_ = handle;
+            wakeups wake{};
+            if (channel_.exchange(*this, wake))
+            {
+                return wake.finish(handle);
+            }
+            channel_.senders_.push(this);
+            trace(trace_event::park, &channel_, handle.address());
+            return wake.park();
+        }
+        auto await_resume() -> bool
+        {
+            return pending().empty();
+        }
+
+        // Used by select with the channel lock held
+        auto select_lock() -> lock_type*
+        {
+            return &channel_.lock_;
+        }
+        auto select_try(std::coroutine_handle<> handle) -> std::coroutine_handle<>
+        {
+            this->handle_ = handle;
+            wakeups wake{};
+            return channel_.exchange(*this, wake) ? wake.finish(handle) : nullptr;
+        }
+        void select_park(select_state& state, std::size_t index, std::coroutine_handle<> handle)
+        {
+            this->handle_ = handle;
+            this->select_ = &state;
+            this->case_ = index;
+            channel_.senders_.push(this);
+            trace(trace_event::park, &channel_, handle.address());
+        }
+        void select_unpark()
+        {
+            channel_.senders_.remove(this);
+        }
+
+        // Values not handed over yet
+        [[nodiscard]] auto pending() -> std::span<Type>
+        {
+            if (many_.empty())
+            {
+                return data_ ? std::span<Type>{&*data_, 1} : std::span<Type>{};
+            }
+            return many_.subspan(count_);
+        }
+        void consume(std::size_t count)
+        {
+            if (many_.empty())
+            {
+                data_.reset();
+                return;
+            }
+            count_ += count;
+        }
+
+        channel& channel_;
+        std::optional<Type> data_{};
+        // Source of send_many, empty for a single send
+        std::span<Type> many_{};
+        std::size_t count_ = 0;
+    };
+
+    auto send(const Type& type) -> async_send
+    {
+        return async_send{*this, std::in_place, type};
+    }
+
+    auto send(Type&& type) -> async_send
+    {
+        return async_send{*this, std::in_place, std::move(type)};
+    }
+
+    // Send a value built from args where it ends up: in the buffer when there
+    // is room and nobody waits, in a parked receiver, and only when it has to
+    // park in the awaiter. Rvalue args are moved into the awaiter, so that it
+    // can be named for select, lvalue args are referenced.
+    template <typename... Args>
+    struct async_emplace_send : public async_send
+    {
+        async_emplace_send(channel& channel, Args&&... args)
+            : async_send{channel, std::span<Type>{}}, args_{std::forward<Args>(args)...}
+        {}
+
+        auto await_ready() -> bool
+        {
+            auto& chan = this->channel_;
+            std::lock_guard lock{chan.lock_};
+            if (chan.closed_)
+            {
+                // Dropped without building the value
+                sent_ = false;
+                return true;
+            }
+            if (!chan.receivers_.empty() || chan.full())
+            {
+                return false;
+            }
+            std::apply(
+                [&chan](Args&&... args) { chan.fifo_.emplace_back(std::forward<Args>(args)...); },
+                std::move(args_));
+            return true;
+        }
+        auto await_suspend(std::coroutine_handle<> handle) -> std::coroutine_handle<>
+        {
+            auto& chan = this->channel_;
+            std::lock_guard lock{chan.lock_};
+            this->handle_ = handle;
+            wakeups wake{};
+            if (auto* recv = pop_claimed(chan.receivers_))
+            {
+                if (recv->many_.empty())
+                {
+                    std::apply(
+                        [recv](Args&&... args) {
+                            recv->data_.emplace(std::forward<Args>(args)...);
+                        },
+                        std::move(args_));
+                }
+                else
+                {
+                    // recv_many takes the value like any other
+                    build();
+                    recv->deliver(&*this->data_, 1);
+                    this->consume(1);
+                }
+                trace(trace_event::handoff, &chan, recv->handle_.address());
+                trace(trace_event::wake, &chan, recv->handle_.address());
+                wake.add(recv->handle_);
+                return wake.finish(handle);
+            }
+            build();
+            if (chan.exchange(*this, wake))
+            {
+                return wake.finish(handle);
+            }
+            chan.senders_.push(this);
+            trace(trace_event::park, &chan, handle.address());
+            return wake.park();
+        }
+        auto await_resume() -> bool
+        {
+            return sent_ && async_send::await_resume();
+        }
+
+        // Used by select with the channel lock held
+        auto select_try(std::coroutine_handle<> handle) -> std::coroutine_handle<>
+        {
+            build();
+            return async_send::select_try(handle);
+        }
+
+    private:
+        void build()
+        {
+            if (!this->data_)
+            {
+                std::apply(
+                    [this](Args&&... args) { this->data_.emplace(std::forward<Args>(args)...); },
+                    std::move(args_));
+            }
+        }
+
+        std::tuple<Args...> args_;
+        bool sent_ = true;
+    };
+    template <typename... Args>
+    auto emplace_send(Args&&... args) -> async_emplace_send<Args...>
+    {
+        return async_emplace_send<Args...>{*this, std::forward<Args>(args)...};
+    }
+
+    // Move every value out of the span, parking at most once. Resumes with the
+    // number of values sent, less than values.size() only if the channel closed.
+    struct async_send_many : public async_send
+    {
+        async_send_many(channel& channel, std::span<Type> values) : async_send{channel, values}
+        {}
+
+        auto await_resume() -> std::size_t
+        {
+            return this->count_;
+        }
+    };
+    auto send_many(std::span<Type> values) -> async_send_many
+    {
+        return async_send_many{*this, values};
+    }
+
+    // Send like send() but give up at the deadline, the value is dropped then.
+    // Resumes with false when the deadline passed or the channel closed first.
+    struct async_send_until : public async_send
+    {
+        async_send_until(channel& channel, Type&& data, timer_wheel::clock::time_point deadline)
+            : async_send{channel, std::move(data)}, timer_{deadline}
+        {}
+
+        auto await_suspend(std::coroutine_handle<> handle) -> std::coroutine_handle<>
+        {
+            auto& chan = this->channel_;
+            std::lock_guard lock{chan.lock_};
+            this->handle_ = handle;
+            wakeups wake{};
+            if (chan.exchange(*this, wake))
+            {
+                return wake.finish(handle);
+            }
+            this->select_ = &timer_.state_;
+            chan.senders_.push(this);
+            trace(trace_event::park, &chan, handle.address());
+            timer_.arm(handle);
+            return wake.park();
+        }
+        auto await_resume() -> bool
+        {
+            if (timer_.expired())
+            {
+                std::lock_guard lock{this->channel_.lock_};
+                this->channel_.senders_.remove(this);
+                return false;
+            }
+            return this->pending().empty();
+        }
+
+        deadline_timer timer_;
+    };
+    auto send_until(Type value, timer_wheel::clock::time_point deadline) -> async_send_until
+    {
+        return async_send_until{*this, std::move(value), deadline};
+    }
+    auto send_for(Type value, timer_wheel::clock::duration timeout) -> async_send_until
+    {
+        return async_send_until{*this, std::move(value), timer_wheel::clock::now() + timeout};
+    }
+
+    // Send like send() until a stop is requested on the token, the value is
+    // dropped then. Resumes with false when cancelled or the channel closed.
+    struct async_send_stoppable : public async_send
+    {
+        async_send_stoppable(channel& channel, Type&& data, std::stop_token token)
+            : async_send{channel, std::move(data)}, stop_{std::move(token)}
+        {}
+
+        auto await_ready() -> bool
+        {
+            return stop_.stop_requested() || async_send::await_ready();
+        }
+        auto await_suspend(std::coroutine_handle<> handle) -> std::coroutine_handle<>
+        {
+            auto& chan = this->channel_;
+            std::lock_guard lock{chan.lock_};
+            this->handle_ = handle;
+            wakeups wake{};
+            if (chan.exchange(*this, wake))
+            {
+                return wake.finish(handle);
+            }
+            this->select_ = &stop_.state_;
+            chan.senders_.push(this);
+            trace(trace_event::park, &chan, handle.address());
+            stop_.arm(handle);
+            return wake.park();
+        }
+        auto await_resume() -> bool
+        {
+            std::lock_guard lock{this->channel_.lock_};
+            if (stop_.cancelled())
+            {
+                this->channel_.senders_.remove(this);
+                return false;
+            }
+            return this->pending().empty();
+        }
+
+        stop_waiter stop_;
+    };
+    auto send(Type value, std::stop_token token) -> async_send_stoppable
+    {
+        return async_send_stoppable{*this, std::move(value), std::move(token)};
+    }
+
+    // Send without waiting, from a coroutine or not. False when the value could
+    // not be handed to a receiver nor buffered, or the channel is closed.
+    auto try_send(Type value) -> bool
+    {
+        async_send send{*this, std::move(value)};
+        wakeups wake{};
+        {
+            std::lock_guard lock{lock_};
+            if (closed_ || !exchange(send, wake))
+            {
+                return false;
+            }
+        }
+        wake.flush();
+        return true;
+    }
+
+    // Wake every parked receiver and sender once, outside of the lock: receivers
+    // resume with the closed result, senders with false and their values not
+    // handed over dropped. Values already buffered can still be received.
+    void close()
+    {
+        wakeups wake{};
+        {
+            std::lock_guard lock{lock_};
+            if (closed_)
+            {
+                return;
+            }
+            closed_ = true;
+            trace(trace_event::close, this);
+            while (auto* recv = pop_claimed(receivers_))
+            {
+                trace(trace_event::wake, this, recv->handle_.address());
+                wake.add(recv->handle_);
+            }
+            while (auto* send = pop_claimed(senders_))
+            {
+                trace(trace_event::wake, this, send->handle_.address());
+                wake.add(send->handle_);
+            }
+        }
+        wake.flush();
+    }
+
+    [[nodiscard]] auto closed() const -> bool
+    {
+        std::lock_guard lock{lock_};
+        return closed_;
+    }
+
+    [[nodiscard]] auto empty() const -> bool
+    {
+        std::lock_guard lock{lock_};
+        return closed_ && receivers_.empty() && senders_.empty();
+    }
+
+    // Resume the coroutines made ready on the calling thread, close() already
+    // queued the waiters it woke there
+    void sync_await()
+    {
+        run_ready();
+    }
+
+private:
+    // Peers made runnable by one exchange. The first one is resumed by
+    // symmetric transfer, the others are queued.
+    class wakeups
+    {
+    public:
+        void add(std::coroutine_handle<> handle)
+        {
+            if (next_)
+            {
+                schedule(handle);
+            }
+            else
+            {
+                next_ = handle;
+            }
+        }
+
+        // The exchange completed: run the first peer right away and queue the
+        // arriving coroutine behind it. Last use of the awaiter, an executor
+        // may resume it as soon as it is scheduled.
+        auto finish(std::coroutine_handle<> self) -> std::coroutine_handle<>
+        {
+            if (!next_)
+            {
+                return self;
+            }
+            schedule(self);
+            return next_;
+        }
+
+        // The arriving coroutine parked
+        auto park() -> std::coroutine_handle<>
+        {
+            return next_ ? next_ : next_ready();
+        }
+
+        // Not called from a coroutine, every peer is queued
+        void flush()
+        {
+            if (next_)
+            {
+                schedule(next_);
+            }
+        }
+
+    private:
+        std::coroutine_handle<> next_{};
+    };
+
+    // A constant with an inline_buffer policy
+    [[nodiscard]] auto buffer_size() const -> std::size_t
+    {
+        if constexpr (requires { Policy::buffer_size; })
+        {
+            return Policy::buffer_size;
+        }
+        else
+        {
+            return buffer_size_;
+        }
+    }
+
+    auto full() const -> bool
+    {
+        return fifo_.size() >= buffer_size();
+    }
+
+    [[nodiscard]] auto room() const -> std::size_t
+    {
+        return buffer_size() - fifo_.size();
+    }
+
+    // Complete a recv from the buffer when that wakes nobody, lock must be held
+    auto recv_ready(async_recv& recv) -> bool
+    {
+        if (!senders_.empty())
+        {
+            return false;
+        }
+        if (!fifo_.empty())
+        {
+            recv.deliver(fifo_, std::min(recv.room(), fifo_.size()));
+            return true;
+        }
+        return closed_;
+    }
+
+    // Complete a send into the buffer when that wakes nobody, or without taking
+    // anything once closed, lock must be held
+    auto send_ready(async_send& send) -> bool
+    {
+        if (closed_)
+        {
+            return true;
+        }
+        if (!receivers_.empty())
+        {
+            // A parked receiver is served by symmetric transfer in await_suspend
+            return false;
+        }
+        auto values = send.pending();
+        const auto count = std::min(room(), values.size());
+        if (count > 0)
+        {
+            fifo_.push_back_n(values.data(), count);
+            send.consume(count);
+        }
+        return send.pending().empty();
+    }
+
+    // Take values from the buffer and from parked senders, lock must be held.
+    // False when the receiver got nothing and has to park.
+    auto exchange(async_recv& recv, wakeups& wake) -> bool
+    {
+        while (recv.room() > 0)
+        {
+            if (!fifo_.empty())
+            {
+                recv.deliver(fifo_, std::min(recv.room(), fifo_.size()));
+                refill(wake);
+                continue;
+            }
+            auto* send = pop_claimed(senders_);
+            if (send == nullptr)
+            {
+                break;
+            }
+            auto values = send->pending();
+            const auto count = std::min(recv.room(), values.size());
+            recv.deliver(values.data(), count);
+            send->consume(count);
+            trace(trace_event::handoff, this, send->handle_.address());
+            release(*send, wake);
+        }
+        return recv.received() > 0 || closed_;
+    }
+
+    // Give values to parked receivers then to the buffer, lock must be held.
+    // False when values are left and the sender has to park, a closed channel
+    // takes none.
+    auto exchange(async_send& send, wakeups& wake) -> bool
+    {
+        if (closed_)
+        {
+            return true;
+        }
+        while (!send.pending().empty())
+        {
+            auto values = send.pending();
+            if (auto* recv = pop_claimed(receivers_))
+            {
+                // A parked receiver runs as soon as it got something
+                const auto count = std::min(recv->room(), values.size());
+                recv->deliver(values.data(), count);
+                send.consume(count);
+                trace(trace_event::handoff, this, recv->handle_.address());
+                trace(trace_event::wake, this, recv->handle_.address());
+                wake.add(recv->handle_);
+                continue;
+            }
+            if (full())
+            {
+                break;
+            }
+            const auto count = std::min(room(), values.size());
+            fifo_.push_back_n(values.data(), count);
+            send.consume(count);
+        }
+        return send.pending().empty();
+    }
+
+    // The slots freed in the buffer belong to the oldest parked senders
+    void refill(wakeups& wake)
+    {
+        while (!full())
+        {
+            auto* send = pop_claimed(senders_);
+            if (send == nullptr)
+            {
+                return;
+            }
+            auto values = send->pending();
+            const auto count = std::min(room(), values.size());
+            fifo_.push_back_n(values.data(), count);
+            send->consume(count);
+            release(*send, wake);
+        }
+    }
+
+    // A parked sender runs again once all its values were handed over
+    void release(async_send& send, wakeups& wake)
+    {
+        if (send.pending().empty())
+        {
+            trace(trace_event::wake, this, send.handle_.address());
+            wake.add(send.handle_);
+        }
+        else
+        {
+            senders_.push_front(&send);
+        }
+    }
+
+    // Skip the waiters of a select already completed by another channel
+    template <typename Waiter>
+    static auto pop_claimed(FIFOList<Waiter>& list) -> Waiter*
+    {
+        while (auto* waiter = list.pop())
+        {
+            if (waiter->claim())
+            {
+                return waiter;
+            }
+        }
+        return nullptr;
+    }
+
+    std::size_t buffer_size_;
+    FIFOList<async_recv> receivers_{};
+    FIFOList<async_send> senders_{};
+    buffer_type fifo_;
+    bool closed_{false};
+    mutable lock_type lock_{};
+};
+
+// Channel buffering Size values inline, the capacity is a compile time
+// constant and nothing is allocated
+//
+//     static_channel<int, 4> replies{};
+template <typename Type, std::size_t Size, typename Policy = single_thread>
+using static_channel = channel<Type, inline_buffer<Size, Policy>>;
+
+// Each side owns one index of the ring and caches the other one, so send and
+// recv only read the peer's cache line when the cached index says the ring
+// looks full or empty. Moving an index is one store followed by a look at
+// the peer's parked word, which is only taken by a compare exchange when the
+// peer parked: no lock and no read-modify-write loop per value, both sides
+// are wait-free. A side parks by raising its word, checking the index again
+// and committing with a compare exchange. Parked coroutines are resumed on
+// the executor they parked on; without an executor both sides must run on the
+// same thread, which works but is slower than channel<Type>. A sender parking right after waking the consumer on its own
+// executor transfers to it instead of going through the run queue.
+//
+// send/recv/try_send/close behave like the primary template, select,
+// deadlines, stop tokens and batches are not available. A send completes once
+// at most buffer_size values are left in the ring, so an unbuffered channel
+// still hands each value over before the sender goes on.
+template <typename Type>
+class channel<Type, spsc>
+{
+public:
+    channel(std::size_t buffer_size = 0)
+        : buffer_size_{buffer_size}
+        , capacity_{std::bit_ceil(buffer_size + 2)}
+        , slots_{allocator_.allocate(capacity_)}
+    {}
+
+    channel(const channel&) = delete;
+    auto operator=(const channel&) -> channel& = delete;
+
+    ~channel()
+    {
+        const auto tail = tail_.load(std::memory_order_relaxed);
+        for (auto head = head_.load(std::memory_order_relaxed); head != tail; ++head)
+        {
+            std::destroy_at(slot(head));
+        }
+        allocator_.deallocate(slots_, capacity_);
+    }
+
+    struct async_recv
+    {
+        [[nodiscard]] auto await_ready() -> bool
+        {
+            return channel_.pop(data_) || channel_.drained();
+        }
+        auto await_suspend(std::coroutine_handle<> handle) -> std::coroutine_handle<>
+        {
+            // The awaiter may be resumed by the producer as soon as it parked
+            auto& chan = channel_;
+            const auto head = chan.head_.load(std::memory_order_relaxed);
+            trace(trace_event::park, &chan, handle.address());
+            if (!chan.park(chan.recv_parked_, chan.receiver_, handle, [&chan, head] {
+                    return chan.tail_.load() == head;
+                }))
+            {
+                return handle;
+            }
+            return next_ready();
+        }
+        auto await_resume()
+        {
+            if (data_ || channel_.pop(data_))
+            {
+                return std::make_tuple(std::move(*data_), true);
+            }
+            return std::make_tuple(Type{}, false);
+        }
+
+        channel& channel_;
+        std::optional<Type> data_{};
+    };
+    auto recv() -> async_recv
+    {
+        return async_recv{*this};
+    }
+
+    // Resumes with true once the value is in the ring, where it can still be
+    // received after a close, false when the channel was closed first
+    struct async_send
+    {
+        [[nodiscard]] auto await_ready() -> bool
+        {
+            // A closed channel drops the value
+            if (channel_.closed())
+            {
+                return true;
+            }
+            channel_.push(std::move(data_), &woken_);
+            sent_ = true;
+            if (!channel_.delivered())
+            {
+                return false;
+            }
+            if (woken_)
+            {
+                // Keep filling the buffer, the consumer runs later
+                schedule(woken_);
+            }
+            return true;
+        }
+        auto await_suspend(std::coroutine_handle<> handle) -> std::coroutine_handle<>
+        {
+            // Copied out, the awaiter may be resumed as soon as it parked
+            auto& chan = channel_;
+            const auto woken = woken_;
+            const auto tail = chan.tail_.load(std::memory_order_relaxed);
+            trace(trace_event::park, &chan, handle.address());
+            if (chan.park(chan.send_parked_, chan.sender_, handle, [&chan, tail] {
+                    return tail - chan.head_.load() > chan.buffer_size_;
+                }))
+            {
+                return woken ? woken : next_ready();
+            }
+            if (woken)
+            {
+                schedule(woken);
+            }
+            return handle;
+        }
+        auto await_resume() -> bool
+        {
+            return sent_;
+        }
+
+        channel& channel_;
+        Type data_;
+        // Consumer woken by the value, resumed by symmetric transfer when the
+        // sender parks
+        std::coroutine_handle<> woken_{};
+        bool sent_ = false;
+    };
+    auto send(const Type& type) -> async_send
+    {
+        return async_send{*this, Type{type}};
+    }
+    auto send(Type&& type) -> async_send
+    {
+        return async_send{*this, std::move(type)};
+    }
+
+    // Send without waiting, from the producer. False when the value could not
+    // be buffered nor handed to the parked consumer, or the channel is closed.
+    auto try_send(Type value) -> bool
+    {
+        if (closed())
+        {
+            return false;
+        }
+        const auto count =
+            tail_.load(std::memory_order_relaxed) - head_.load(std::memory_order_acquire);
+        const bool waiting =
+            count == 0 && (recv_parked_.load(std::memory_order_acquire) & state_mask) == parked;
+        if (count >= buffer_size_ && !waiting)
+        {
+            return false;
+        }
+        push(std::move(value), nullptr);
+        return true;
+    }
+
+    // Resume both sides if parked, values already in the ring can still be
+    // received. Callable from any thread.
+    void close()
+    {
+        if (closed_.exchange(true))
+        {
+            return;
+        }
+        trace(trace_event::close, this);
+        const auto always = [] { return true; };
+        if (take(recv_parked_, always))
+        {
+            resume(receiver_, nullptr);
+        }
+        if (take(send_parked_, always))
+        {
+            resume(sender_, nullptr);
+        }
+    }
+
+    [[nodiscard]] auto closed() const -> bool
+    {
+        return closed_.load(std::memory_order_acquire);
+    }
+
+    [[nodiscard]] auto empty() const -> bool
+    {
+        return closed() && (recv_parked_.load(std::memory_order_acquire) & state_mask) == idle &&
+               (send_parked_.load(std::memory_order_acquire) & state_mask) == idle;
+    }
+
+    void sync_await()
+    {
+        run_ready();
+    }
+
+private:
+    // Parked words hold a state below the generation of the last park. A side
+    // announces itself parking before checking the peer's index again and
+    // only commits to parked afterwards, so it never touches the channel once
+    // the peer may have resumed it. The generation keeps a peer late to take
+    // one park from taking the next one.
+    static constexpr std::size_t idle = 0;
+    static constexpr std::size_t parking = 1;
+    static constexpr std::size_t parked = 2;
+    static constexpr std::size_t state_mask = 3;
+    static constexpr std::size_t generation_step = 4;
+
+    // Written by its side before parking, read by whoever takes the park
+    struct waiter
+    {
+        std::coroutine_handle<> handle_{};
+        executor* executor_ = nullptr;
+    };
+
+    auto slot(std::size_t index) -> Type*
+    {
+        return &slots_[index & (capacity_ - 1)];
+    }
+
+    // Consumer side
+    auto pop(std::optional<Type>& out) -> bool
+    {
+        const auto head = head_.load(std::memory_order_relaxed);
+        if (head == tail_cache_)
+        {
+            tail_cache_ = tail_.load(std::memory_order_acquire);
+            if (head == tail_cache_)
+            {
+                return false;
+            }
+        }
+        out.emplace(std::move(*slot(head)));
+        std::destroy_at(slot(head));
+        head_.store(head + 1);
+        // A parked producer waits for at most buffer_size values left
+        if (take(send_parked_, [this, head] {
+                return tail_.load(std::memory_order_relaxed) - (head + 1) <= buffer_size_;
+            }))
+        {
+            resume(sender_, nullptr);
+        }
+        return true;
+    }
+
+    // Closed and nothing left to receive, the producer pushes before closing
+    auto drained() -> bool
+    {
+        return closed() &&
+               tail_.load(std::memory_order_acquire) == head_.load(std::memory_order_relaxed);
+    }
+
+    // Producer side. A consumer it wakes on the caller's executor is stored
+    // in woken when not nullptr, scheduled otherwise.
+    void push(Type&& value, std::coroutine_handle<>* woken)
+    {
+        const auto tail = tail_.load(std::memory_order_relaxed);
+        std::construct_at(slot(tail), std::move(value));
+        tail_.store(tail + 1);
+        if (take(recv_parked_, [this, tail] {
+                return head_.load(std::memory_order_relaxed) != tail + 1;
+            }))
+        {
+            resume(receiver_, woken);
+        }
+    }
+
+    auto delivered() -> bool
+    {
+        const auto tail = tail_.load(std::memory_order_relaxed);
+        if (tail - head_cache_ <= buffer_size_)
+        {
+            return true;
+        }
+        head_cache_ = head_.load(std::memory_order_acquire);
+        return tail - head_cache_ <= buffer_size_;
+    }
+
+    // Called after moving an index or closing. Like the store of the index,
+    // the load is sequentially consistent and pairs with the ones of park():
+    // either the parking side sees the move, or this sees its word raised.
+    // True when the caller has to resume the side.
+    //
+    // A parked side is only taken once ready() says it can go on, the move may
+    // be one it already saw before parking. A side still parking is made to
+    // check again instead, a later park of it is left alone.
+    template <typename Ready>
+    static auto take(std::atomic<std::size_t>& word, Ready ready) -> bool
+    {
+        auto current = word.load();
+        const auto generation = current & ~state_mask;
+        while ((current & state_mask) != idle && (current & ~state_mask) == generation)
+        {
+            if ((current & state_mask) == parked && !ready())
+            {
+                return false;
+            }
+            if (word.compare_exchange_weak(current, generation, std::memory_order_acq_rel,
+                                           std::memory_order_acquire))
+            {
+                return (current & state_mask) == parked;
+            }
+        }
+        return false;
+    }
+
+    // Park while blocked() holds and the channel is open. False when the
+    // coroutine must not suspend. Once parked it may already run elsewhere
+    // and its channel be gone. A peer taking the word while it is still
+    // parking only costs one more check.
+    template <typename Blocked>
+    auto park(std::atomic<std::size_t>& word, waiter& side, std::coroutine_handle<> handle,
+              Blocked blocked) -> bool
+    {
+        side.handle_ = handle;
+        side.executor_ = executor::current();
+        while (true)
+        {
+            // Only this side moves the generation
+            const auto generation =
+                (word.load(std::memory_order_relaxed) & ~state_mask) + generation_step;
+            word.store(generation | parking);
+            if (closed_.load() || !blocked())
+            {
+                word.store(generation, std::memory_order_relaxed);
+                return false;
+            }
+            auto expected = generation | parking;
+            if (word.compare_exchange_strong(expected, generation | parked,
+                                             std::memory_order_release, std::memory_order_relaxed))
+            {
+                return true;
+            }
+        }
+    }
+
+    void resume(waiter& side, std::coroutine_handle<>* woken)
+    {
+        trace(trace_event::wake, this, side.handle_.address());
+        if (woken != nullptr && side.executor_ == executor::current())
+        {
+            *woken = side.handle_;
+        }
+        else if (side.executor_ != nullptr)
+        {
+            side.executor_->schedule(side.handle_);
+        }
+        else
+        {
+            schedule(side.handle_);
+        }
+    }
+
+    const std::size_t buffer_size_;
+    const std::size_t capacity_;
+    [[no_unique_address]] std::allocator<Type> allocator_{};
+    Type* const slots_;
+    // Moved by the consumer
+    alignas(cache_line_size) std::atomic<std::size_t> head_{0};
+    std::size_t tail_cache_ = 0;
+    waiter receiver_{};
+    // Moved by the producer
+    alignas(cache_line_size) std::atomic<std::size_t> tail_{0};
+    std::size_t head_cache_ = 0;
+    waiter sender_{};
+    // Read after every move, written only when a side parks or on close
+    alignas(cache_line_size) std::atomic<std::size_t> recv_parked_{idle};
+    std::atomic<std::size_t> send_parked_{idle};
+    std::atomic<bool> closed_{false};
+};
@@ -0,0 +1,475 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <coroutine>
+#include <cstddef>
+#include <cstdint>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "frame_pool.hh"
+#include "futex_waiter.hh"
+#include "lazy.hh"
+#include "ring_buffer.hh"
+#include "spinlock.hh"
+#include "timer_wheel.hh"
+
+// Thread pool resuming coroutines made runnable by channels. Every worker owns
+// a fixed size run queue, a burst that does not fit spills to a queue shared by
+// the pool. A worker without work takes from the shared queue, then steals
+// from the back of its siblings' queues and goes to sleep when there is nothing
+// left to steal. Timers armed from a worker live in the pool's wheel. Between
+// two coroutines a worker only compares the clock with the wheel's next
+// expiry, the one that finds it due advances the wheel while the others carry
+// on, and an idle worker ticks instead of sleeping while timers are armed. Coroutines parked on a futex are watched by one extra thread of
+// the pool, started the first time one parks.
+class executor
+{
+public:
+    explicit executor(std::size_t workers = std::thread::hardware_concurrency())
+    {
+        workers = std::max<std::size_t>(workers, 1);
+        for (std::size_t i = 0; i < workers; ++i)
+        {
+            workers_.push_back(std::make_unique<worker>());
+        }
+        for (std::size_t i = 0; i < workers; ++i)
+        {
+            threads_.emplace_back([this, i] { run(i); });
+        }
+    }
+
+    executor(const executor&) = delete;
+    auto operator=(const executor&) -> executor& = delete;
+
+    ~executor()
+    {
+        stop_.store(true);
+        if (futex_thread_.joinable())
+        {
+            futexes_.stop();
+            futex_thread_.join();
+        }
+        signal_.fetch_add(1);
+        signal_.notify_all();
+        threads_.clear();
+    }
+
+    // Executor driving the calling thread, nullptr outside of a worker
+    static auto current() -> executor*
+    {
+        return current_;
+    }
+
+    void schedule(std::coroutine_handle<> handle)
+    {
+        // Stay on the worker that made the coroutine runnable, its frame is
+        // likely still in this core's cache
+        const std::size_t index =
+            current_ == this ? current_index_
+                             : next_.fetch_add(1, std::memory_order_relaxed) % workers_.size();
+        auto& queue = *workers_[index];
+        bool queued = false;
+        {
+            std::lock_guard lock{queue.lock_};
+            if (queue.handles_.size() < queue.handles_.capacity())
+            {
+                queue.handles_.push_back(handle);
+                queued = true;
+            }
+        }
+        if (!queued)
+        {
+            // Grows to the largest burst once, then stops allocating
+            std::lock_guard lock{overflow_lock_};
+            overflow_.push_back(handle);
+            overflowed_.fetch_add(1, std::memory_order_relaxed);
+        }
+        signal_.fetch_add(1);
+        if (sleepers_.load() > 0)
+        {
+            signal_.notify_one();
+        }
+    }
+
+    // Next handle of the calling worker's own queue, nullptr when it is empty
+    auto next() -> std::coroutine_handle<>
+    {
+        auto& queue = *workers_[current_index_];
+        std::lock_guard lock{queue.lock_};
+        if (queue.handles_.empty())
+        {
+            return nullptr;
+        }
+        auto handle = queue.handles_.front();
+        queue.handles_.pop_front();
+        return handle;
+    }
+
+    // Run a lazy task to completion on the pool, its result is discarded
+    template <typename Type, typename Allocator>
+    void spawn(std::lazy<Type, Allocator> task)
+    {
+        tasks_.fetch_add(1);
+        schedule(detach(*this, std::move(task)).handle_);
+    }
+
+    auto timers() -> timer_wheel&
+    {
+        return timers_;
+    }
+
+    // Schedule the coroutine of wait on the pool once its futex word moved
+    void wait_futex(futex_waiter::entry& wait)
+    {
+        std::call_once(futex_started_, [this] {
+            futex_thread_ = std::jthread{[this] {
+                while (!futexes_.stopped())
+                {
+                    futexes_.wait([this](std::coroutine_handle<> handle) { schedule(handle); });
+                }
+            }};
+        });
+        futexes_.add(wait);
+    }
+
+    // Block until every spawned task finished
+    void wait()
+    {
+        auto tasks = tasks_.load();
+        while (tasks != 0)
+        {
+            tasks_.wait(tasks);
+            tasks = tasks_.load();
+        }
+    }
+
+private:
+    static constexpr std::size_t worker_capacity = 256;
+    // Pops between two looks at the shared queue while the own one has work
+    static constexpr std::size_t overflow_interval = 61;
+
+    struct alignas(64) worker
+    {
+        spinlock lock_{};
+        inline_ring_buffer<std::coroutine_handle<>, worker_capacity> handles_{};
+        // Only touched by the worker's own thread
+        std::size_t pops_ = 0;
+    };
+
+    struct detached
+    {
+        struct promise_type
+        {
+            // Spawning a task must not hit the global heap either
+            static auto operator new(std::size_t size) -> void*
+            {
+                return frame_pool::allocate(size);
+            }
+            static void operator delete(void* ptr) noexcept
+            {
+                frame_pool::deallocate(ptr);
+            }
+
+            auto get_return_object() -> detached
+            {
+                return {std::coroutine_handle<promise_type>::from_promise(*this)};
+            }
+            auto initial_suspend() -> std::suspend_always
+            {
+                return {};
+            }
+            auto final_suspend() noexcept -> std::suspend_never
+            {
+                return {};
+            }
+            void return_void()
+            {}
+            void unhandled_exception()
+            {
+                std::terminate();
+            }
+        };
+        std::coroutine_handle<promise_type> handle_;
+    };
+
+    template <typename Type, typename Allocator>
+    static auto detach(executor& self, std::lazy<Type, Allocator> task) -> detached
+    {
+        co_await std::move(task);
+        if (self.tasks_.fetch_sub(1) == 1)
+        {
+            self.tasks_.notify_all();
+        }
+    }
+
+    void run(std::size_t index)
+    {
+        current_ = this;
+        current_index_ = index;
+        while (true)
+        {
+            // Read the signal before stop_: the destructor sets stop_ then
+            // bumps the signal, so either stop_ is seen or the wait returns
+            const auto signal = signal_.load();
+            if (stop_.load())
+            {
+                break;
+            }
+            if (!timers_.empty() && timers_.due() && !ticking_.exchange(true))
+            {
+                timers_.advance();
+                ticking_.store(false);
+            }
+            if (auto handle = pop(index))
+            {
+                handle.resume();
+                continue;
+            }
+            sleepers_.fetch_add(1);
+            // Recheck after announcing ourselves, a concurrent schedule either
+            // sees the sleeper or left a handle we find here
+            if (auto handle = pop(index))
+            {
+                sleepers_.fetch_sub(1);
+                handle.resume();
+                continue;
+            }
+            if (!timers_.empty() && !ticking_.exchange(true))
+            {
+                // One idle worker keeps the wheel turning while timers are armed
+                std::this_thread::sleep_for(timer_wheel::resolution);
+                ticking_.store(false);
+            }
+            else
+            {
+                signal_.wait(signal);
+            }
+            sleepers_.fetch_sub(1);
+        }
+        current_ = nullptr;
+    }
+
+    // Own queue first in FIFO order, then the shared queue, then steal the
+    // newest handle of a sibling. Every few pops the shared queue goes first
+    // so that a busy worker does not starve what a burst spilled there.
+    auto pop(std::size_t index) -> std::coroutine_handle<>
+    {
+        auto& own = *workers_[index];
+        if (++own.pops_ % overflow_interval == 0)
+        {
+            if (auto handle = pop_overflow())
+            {
+                return handle;
+            }
+        }
+        {
+            std::lock_guard lock{own.lock_};
+            if (!own.handles_.empty())
+            {
+                auto handle = own.handles_.front();
+                own.handles_.pop_front();
+                return handle;
+            }
+        }
+        if (auto handle = pop_overflow())
+        {
+            return handle;
+        }
+        for (std::size_t i = 1; i < workers_.size(); ++i)
+        {
+            auto& victim = *workers_[(index + i) % workers_.size()];
+            if (!victim.lock_.try_lock())
+            {
+                continue;
+            }
+            std::lock_guard lock{victim.lock_, std::adopt_lock};
+            if (!victim.handles_.empty())
+            {
+                auto handle = victim.handles_.back();
+                victim.handles_.pop_back();
+                return handle;
+            }
+        }
+        return nullptr;
+    }
+
+    auto pop_overflow() -> std::coroutine_handle<>
+    {
+        if (overflowed_.load(std::memory_order_relaxed) == 0)
+        {
+            return nullptr;
+        }
+        std::lock_guard lock{overflow_lock_};
+        if (overflow_.empty())
+        {
+            return nullptr;
+        }
+        auto handle = overflow_.front();
+        overflow_.pop_front();
+        overflowed_.fetch_sub(1, std::memory_order_relaxed);
+        return handle;
+    }
+
+    static inline thread_local executor* current_ = nullptr;
+    static inline thread_local std::size_t current_index_ = 0;
+
+    std::vector<std::unique_ptr<worker>> workers_{};
+    spinlock overflow_lock_{};
+    ring_buffer<std::coroutine_handle<>> overflow_{worker_capacity};
+    std::atomic<std::size_t> overflowed_{0};
+    std::atomic<std::size_t> next_{0};
+    std::atomic<std::size_t> tasks_{0};
+    std::atomic<std::uint32_t> signal_{0};
+    std::atomic<std::size_t> sleepers_{0};
+    std::atomic<bool> stop_{false};
+    std::atomic<bool> ticking_{false};
+    timer_wheel timers_{};
+    futex_waiter futexes_{};
+    std::once_flag futex_started_{};
+    std::jthread futex_thread_{};
+    std::vector<std::jthread> threads_{};
+};
+
+// Coroutines made runnable on a thread no executor drives. Grows to the most
+// coroutines ever runnable at once and keeps that capacity, so channel wakeups
+// stop allocating once the thread is warm.
+inline auto ready_queue() -> ring_buffer<std::coroutine_handle<>>&
+{
+    constexpr std::size_t initial_capacity = 256;
+    thread_local ring_buffer<std::coroutine_handle<>> queue{initial_capacity};
+    return queue;
+}
+
+// Timers of the executor driving the calling thread, or of the thread itself
+inline auto timers() -> timer_wheel&
+{
+    if (auto* exec = executor::current())
+    {
+        return exec->timers();
+    }
+    thread_local timer_wheel wheel{};
+    return wheel;
+}
+
+// Coroutines parked on a futex by a thread no executor drives, run_ready()
+// sleeps on them
+inline auto futex_waits() -> futex_waiter&
+{
+    thread_local futex_waiter waiter{};
+    return waiter;
+}
+
+// Resume the coroutine of wait once its futex word moved, on the executor
+// driving the calling thread or from run_ready() when there is none. The
+// coroutine may be resumed before this returns.
+inline void wait_futex(futex_waiter::entry& wait)
+{
+    if (auto* exec = executor::current())
+    {
+        exec->wait_futex(wait);
+    }
+    else
+    {
+        futex_waits().add(wait);
+    }
+}
+
+// Make a coroutine runnable on the executor driving the calling thread, or on
+// the thread's ready queue when there is none
+inline void schedule(std::coroutine_handle<> handle)
+{
+    if (auto* exec = executor::current())
+    {
+        exec->schedule(handle);
+    }
+    else
+    {
+        ready_queue().push_back(handle);
+    }
+}
+
+// Coroutine to transfer to when the current one parks. Symmetric transfer is
+// only a tail call when the compiler manages it, which sanitizers prevent, so
+// every few transfers control goes back to the run loop to unwind the stack.
+inline auto next_ready() -> std::coroutine_handle<>
+{
+    constexpr int max_transfers = 64;
+    thread_local int transfers = 0;
+    if (++transfers == max_transfers)
+    {
+        transfers = 0;
+        return std::noop_coroutine();
+    }
+    if (auto* exec = executor::current())
+    {
+        if (auto handle = exec->next())
+        {
+            return handle;
+        }
+        return std::noop_coroutine();
+    }
+    auto& queue = ready_queue();
+    if (queue.empty())
+    {
+        return std::noop_coroutine();
+    }
+    auto handle = queue.front();
+    queue.pop_front();
+    return handle;
+}
+
+// Resume the ready coroutines of a thread no executor drives, sleeping until
+// the next tick while armed timers may still make one runnable, and on the
+// futex words of its parked coroutines. A ticker left running keeps this from
+// returning.
+inline void run_ready()
+{
+    auto& queue = ready_queue();
+    auto& wheel = timers();
+    auto& futexes = futex_waits();
+    const auto push = [&queue](std::coroutine_handle<> handle) { queue.push_back(handle); };
+    while (true)
+    {
+        while (!queue.empty())
+        {
+            auto handle = queue.front();
+            queue.pop_front();
+            handle.resume();
+        }
+        if (!futexes.empty())
+        {
+            futexes.collect(push);
+            if (!queue.empty())
+            {
+                continue;
+            }
+        }
+        if (wheel.empty() && futexes.empty())
+        {
+            return;
+        }
+        if (!wheel.empty())
+        {
+            wheel.advance();
+        }
+        if (!queue.empty())
+        {
+            continue;
+        }
+        if (futexes.empty())
+        {
+            std::this_thread::sleep_for(timer_wheel::resolution);
+        }
+        else
+        {
+            futexes.wait(push, wheel.empty() ? std::chrono::nanoseconds::max()
+                                             : std::chrono::nanoseconds{timer_wheel::resolution});
+        }
+    }
+}
@@ -0,0 +1,254 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <bit>
+#include <cstddef>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <vector>
+
+#include "lazy.hh"
+
+struct frame_pool_stats
+{
+    // Frames handed out, whether they came from a free list or not
+    std::size_t allocations = 0;
+    // Calls to ::operator new, chunk refills and oversized frames
+    std::size_t heap_allocations = 0;
+    // Frames released by another thread than the one that allocated them
+    std::size_t remote_frees = 0;
+};
+
+// Size class allocator for coroutine frames. Every thread allocates from its
+// own pool without synchronization, a frame released by another thread is
+// pushed on a lock-free list of its owner and taken back when the owner's
+// free list runs dry. A pool grows to the most frames of its thread ever live
+// at once, counting those another thread has not released yet, and stops
+// allocating from the heap once that peak repeats. Memory is never returned
+// to the system, a pool whose thread exited is adopted by the next thread
+// needing one.
+class frame_pool
+{
+public:
+    frame_pool(const frame_pool&) = delete;
+    auto operator=(const frame_pool&) -> frame_pool& = delete;
+
+    static auto allocate(std::size_t size) -> void*
+    {
+        return local().allocate_block(size);
+    }
+
+    static void deallocate(void* ptr) noexcept
+    {
+        auto* block = reinterpret_cast<free_block*>(static_cast<std::byte*>(ptr) - header_size);
+        if (block->size_class_ == oversized)
+        {
+            ::operator delete(block);
+            return;
+        }
+        auto& self = local();
+        if (block->owner_ == &self)
+        {
+            block->next_ = self.free_[block->size_class_];
+            self.free_[block->size_class_] = block;
+            return;
+        }
+        bump(self.remote_frees_);
+        auto& remote = block->owner_->remote_[block->size_class_];
+        block->next_ = remote.load(std::memory_order_relaxed);
+        while (!remote.compare_exchange_weak(block->next_, block, std::memory_order_release,
+                                             std::memory_order_relaxed))
+        {}
+    }
+
+    // Counters summed over every pool, meant for tests and benchmarks
+    static auto stats() -> frame_pool_stats
+    {
+        auto& pools = registry();
+        std::lock_guard lock{pools.lock_};
+        frame_pool_stats total{};
+        for (const auto& pool : pools.pools_)
+        {
+            total.allocations += pool->allocations_.load(std::memory_order_relaxed);
+            total.heap_allocations += pool->heap_allocations_.load(std::memory_order_relaxed);
+            total.remote_frees += pool->remote_frees_.load(std::memory_order_relaxed);
+        }
+        return total;
+    }
+
+private:
+    frame_pool() = default;
+
+    struct alignas(__STDCPP_DEFAULT_NEW_ALIGNMENT__) header
+    {
+        frame_pool* owner_;
+        std::size_t size_class_;
+    };
+
+    // The link only lives while the block is free, it overlaps the frame
+    struct free_block : header
+    {
+        free_block* next_;
+    };
+
+    static constexpr std::size_t header_size = sizeof(header);
+    static constexpr std::size_t min_block = 64;
+    static constexpr std::size_t size_classes = 7; // 64 to 4096 bytes
+    static constexpr std::size_t oversized = size_classes;
+    static constexpr std::size_t chunk_size = 64 * 1024;
+
+    struct pool_registry
+    {
+        std::mutex lock_{};
+        std::vector<std::unique_ptr<frame_pool>> pools_{};
+    };
+
+    static auto registry() -> pool_registry&
+    {
+        // Leaked on purpose, frames may be released by static destructors
+        static auto* pools = new pool_registry{};
+        return *pools;
+    }
+
+    // Binds a pool to a thread for the thread's lifetime
+    class binding
+    {
+    public:
+        binding()
+        {
+            auto& pools = registry();
+            std::lock_guard lock{pools.lock_};
+            for (const auto& pool : pools.pools_)
+            {
+                if (pool->abandoned_)
+                {
+                    pool->abandoned_ = false;
+                    pool_ = pool.get();
+                    return;
+                }
+            }
+            pool_ = pools.pools_.emplace_back(new frame_pool{}).get();
+        }
+
+        binding(const binding&) = delete;
+        auto operator=(const binding&) -> binding& = delete;
+
+        ~binding()
+        {
+            auto& pools = registry();
+            std::lock_guard lock{pools.lock_};
+            pool_->abandoned_ = true;
+        }
+
+        frame_pool* pool_;
+    };
+
+    static auto local() -> frame_pool&
+    {
+        thread_local binding bound{};
+        return *bound.pool_;
+    }
+
+    static auto size_class(std::size_t bytes) -> std::size_t
+    {
+        const std::size_t block = std::bit_ceil(std::max(bytes, min_block));
+        return static_cast<std::size_t>(std::countr_zero(block / min_block));
+    }
+
+    // Written by the owning thread only, atomic so that stats() may read them
+    static void bump(std::atomic<std::size_t>& counter) noexcept
+    {
+        counter.store(counter.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    }
+
+    auto allocate_block(std::size_t size) -> void*
+    {
+        bump(allocations_);
+        const std::size_t bytes = size + header_size;
+        const std::size_t index = size_class(bytes);
+        if (index >= size_classes)
+        {
+            bump(heap_allocations_);
+            auto* block = static_cast<free_block*>(::operator new(bytes));
+            block->owner_ = this;
+            block->size_class_ = oversized;
+            return reinterpret_cast<std::byte*>(block) + header_size;
+        }
+        auto* block = free_[index];
+        if (block == nullptr)
+        {
+            block = remote_[index].exchange(nullptr, std::memory_order_acquire);
+        }
+        if (block == nullptr)
+        {
+            block = refill(index);
+        }
+        free_[index] = block->next_;
+        return reinterpret_cast<std::byte*>(block) + header_size;
+    }
+
+    // Carve a new chunk into blocks of the size class, the chunk is never freed
+    auto refill(std::size_t index) -> free_block*
+    {
+        bump(heap_allocations_);
+        const std::size_t block_size = min_block << index;
+        auto* chunk = static_cast<std::byte*>(::operator new(chunk_size));
+        free_block* head = nullptr;
+        for (std::size_t offset = chunk_size; offset >= block_size; offset -= block_size)
+        {
+            auto* block = reinterpret_cast<free_block*>(chunk + offset - block_size);
+            block->owner_ = this;
+            block->size_class_ = index;
+            block->next_ = head;
+            head = block;
+        }
+        return head;
+    }
+
+    std::array<free_block*, size_classes> free_{};
+    alignas(64) std::array<std::atomic<free_block*>, size_classes> remote_{};
+    alignas(64) std::atomic<std::size_t> allocations_{0};
+    std::atomic<std::size_t> heap_allocations_{0};
+    std::atomic<std::size_t> remote_frees_{0};
+    bool abandoned_ = false;
+};
+
+// Stateless allocator over frame_pool, meant to be the allocator parameter of
+// std::lazy so that coroutine frames skip the global heap:
+//
+//     auto task() -> std::lazy<int, frame_allocator<std::byte>>
+template <typename Type>
+class frame_allocator
+{
+public:
+    using value_type = Type;
+    using is_always_equal = std::true_type;
+
+    frame_allocator() = default;
+
+    template <typename Other>
+    explicit(false) frame_allocator(const frame_allocator<Other>& /*other*/) noexcept
+    {}
+
+    [[nodiscard]] auto allocate(std::size_t count) -> Type*
+    {
+        return static_cast<Type*>(frame_pool::allocate(count * sizeof(Type)));
+    }
+
+    void deallocate(Type* ptr, std::size_t /*count*/) noexcept
+    {
+        frame_pool::deallocate(ptr);
+    }
+
+    template <typename Other>
+    auto operator==(const frame_allocator<Other>& /*other*/) const noexcept -> bool
+    {
+        return true;
+    }
+};
+
+// Lazy task whose frame comes from the calling thread's frame_pool
+template <typename Type = void>
+using pooled_lazy = std::lazy<Type, frame_allocator<std::byte>>;
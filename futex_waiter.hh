@@ -0,0 +1,174 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <coroutine>
+#include <cstddef>
+#include <cstdint>
+#include <ctime>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "spinlock.hh"
+
+// Coroutines parked on futex words, possibly shared with other processes.
+// One thread sleeps on all of them at once with futex_waitv and hands back
+// the coroutines whose word moved, so parking never blocks the thread of the
+// coroutine. Kernels without futex_waitv (before 5.16) get polled every
+// millisecond instead.
+class futex_waiter
+{
+public:
+    static constexpr auto poll_interval = std::chrono::milliseconds{1};
+
+    // Intrusive wait, owned by the caller and listed while parked. The
+    // coroutine sleeps while word_ holds parked_. Once it changed, ready_
+    // either says the coroutine can run or arms the word again; it runs under
+    // the waiter's lock.
+    struct entry
+    {
+        std::atomic<std::uint32_t>* word_ = nullptr;
+        std::uint32_t parked_ = 0;
+        bool (*ready_)(entry&) = nullptr;
+        std::coroutine_handle<> handle_{};
+    };
+
+    futex_waiter() = default;
+    futex_waiter(const futex_waiter&) = delete;
+    auto operator=(const futex_waiter&) -> futex_waiter& = delete;
+
+    // Callable from any thread, the entry may be handed back before this
+    // returns
+    void add(entry& wait)
+    {
+        {
+            std::lock_guard lock{lock_};
+            entries_.push_back(&wait);
+            size_.store(entries_.size(), std::memory_order_release);
+        }
+        // Either the driver sees the new control value or this sees it asleep
+        control_.fetch_add(1);
+        if (sleeping_.load())
+        {
+            futex(control_, FUTEX_WAKE_PRIVATE, INT32_MAX);
+        }
+    }
+
+    // Make the current and every later wait() return at once
+    void stop()
+    {
+        stopped_.store(true);
+        control_.fetch_add(1);
+        futex(control_, FUTEX_WAKE_PRIVATE, INT32_MAX);
+    }
+
+    [[nodiscard]] auto stopped() const -> bool
+    {
+        return stopped_.load();
+    }
+
+    [[nodiscard]] auto empty() const -> bool
+    {
+        return size_.load(std::memory_order_acquire) == 0;
+    }
+
+    // Hand the coroutines whose word moved and which are ready to resume(),
+    // without blocking. Only one thread drives a waiter.
+    template <typename Resume>
+    void collect(Resume resume)
+    {
+        {
+            std::lock_guard lock{lock_};
+            std::erase_if(entries_, [this](entry* wait) {
+                if (wait->word_->load() == wait->parked_ || !wait->ready_(*wait))
+                {
+                    return false;
+                }
+                runnable_.push_back(wait->handle_);
+                return true;
+            });
+            size_.store(entries_.size(), std::memory_order_release);
+        }
+        for (auto handle : runnable_)
+        {
+            resume(handle);
+        }
+        runnable_.clear();
+    }
+
+    // Sleep until a word moved, add() or stop() was called or the timeout
+    // elapsed, then collect()
+    template <typename Resume>
+    void wait(Resume resume, std::chrono::nanoseconds timeout = std::chrono::nanoseconds::max())
+    {
+        const auto control = control_.load();
+        if (stopped())
+        {
+            return;
+        }
+        {
+            std::lock_guard lock{lock_};
+            waits_.clear();
+            waits_.push_back(futex_waitv{control, address(control_), FUTEX_32 | FUTEX_PRIVATE_FLAG,
+                                         0});
+            for (auto* wait : entries_)
+            {
+                if (waits_.size() == FUTEX_WAITV_MAX)
+                {
+                    // The others are only polled
+                    timeout = std::min<std::chrono::nanoseconds>(timeout, poll_interval);
+                    break;
+                }
+                waits_.push_back(futex_waitv{wait->parked_, address(*wait->word_), FUTEX_32, 0});
+            }
+        }
+        timespec deadline{};
+        const bool bounded = timeout != std::chrono::nanoseconds::max();
+        if (bounded)
+        {
+            ::clock_gettime(CLOCK_MONOTONIC, &deadline);
+            const auto nanoseconds = deadline.tv_nsec + timeout.count();
+            deadline.tv_sec += nanoseconds / 1'000'000'000;
+            deadline.tv_nsec = nanoseconds % 1'000'000'000;
+        }
+        // Returns at once when a word already differs from its parked value
+        sleeping_.store(true);
+        if (::syscall(SYS_futex_waitv, waits_.data(), waits_.size(), 0,
+                      bounded ? &deadline : nullptr, CLOCK_MONOTONIC) < 0 &&
+            errno == ENOSYS)
+        {
+            std::this_thread::sleep_for(poll_interval);
+        }
+        sleeping_.store(false, std::memory_order_relaxed);
+        collect(resume);
+    }
+
+private:
+    static auto address(std::atomic<std::uint32_t>& word) -> std::uint64_t
+    {
+        return reinterpret_cast<std::uintptr_t>(&word);
+    }
+
+    static void futex(std::atomic<std::uint32_t>& word, int op, std::uint32_t value)
+    {
+        ::syscall(SYS_futex, reinterpret_cast<std::uint32_t*>(&word), op, value, nullptr, nullptr,
+                  0);
+    }
+
+    spinlock lock_{};
+    std::vector<entry*> entries_{};
+    std::atomic<std::size_t> size_{0};
+    std::atomic<std::uint32_t> control_{0};
+    std::atomic<bool> sleeping_{false};
+    std::atomic<bool> stopped_{false};
+    // Used by the driving thread only
+    std::vector<futex_waitv> waits_{};
+    std::vector<std::coroutine_handle<>> runnable_{};
+};
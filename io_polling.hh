@@ -0,0 +1,475 @@
+#pragma once
+
+#include <array>
+#include <cerrno>
+#include <chrono>
+#include <coroutine>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <span>
+#include <system_error>
+#include <utility>
+#include <vector>
+
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "executor.hh"
+#include "timer_wheel.hh"
+#include "uring.hh"
+
+enum class io_backend
+{
+    epoll,
+    uring,
+};
+
+// I/O reactor of the thread running it, coroutines it wakes go through
+// schedule() like channel peers. Two backends behind the same awaitables:
+//
+// - uring: read()/write()/accept() are one submission entry each and complete
+//   when their CQE arrives. O_NONBLOCK is cleared from an fd on its first
+//   operation so that the kernel waits for readiness itself instead of
+//   completing with -EAGAIN, don't share the fd with code expecting it set.
+//   Entries prepared while the ready queue drains are submitted together by
+//   the next io_uring_enter, which also waits.
+// - epoll: edge-triggered readiness, every fd is registered once for both
+//   directions on first use. read()/write()/accept() try their syscall right
+//   away and, on EAGAIN, park on the fd where each readiness edge retries it
+//   before resuming the coroutine. Used when io_uring is unavailable.
+//
+//     while (::read(fd, buf, size) < 0 && errno == EAGAIN)
+//     {
+//         co_await io.readable(fd);
+//     }
+class io_polling
+{
+public:
+    explicit io_polling(io_backend preferred = io_backend::uring)
+    {
+        if (preferred == io_backend::uring)
+        {
+            try
+            {
+                ring_ = std::make_unique<uring>(ring_entries);
+                return;
+            }
+            catch (const std::system_error&)
+            {
+                // Kernel too old, io_uring disabled or forbidden by seccomp
+            }
+        }
+        epoll_ = ::epoll_create1(EPOLL_CLOEXEC);
+        if (epoll_ < 0)
+        {
+            throw std::system_error(errno, std::generic_category(), "epoll_create1");
+        }
+    }
+
+    io_polling(const io_polling&) = delete;
+    auto operator=(const io_polling&) -> io_polling& = delete;
+
+    ~io_polling()
+    {
+        if (epoll_ >= 0)
+        {
+            ::close(epoll_);
+        }
+    }
+
+    [[nodiscard]] auto backend() const -> io_backend
+    {
+        return ring_ ? io_backend::uring : io_backend::epoll;
+    }
+
+    // Operation in flight: user_data of its submission entry with io_uring,
+    // parked on its fd with epoll. retry_, when set, runs the operation again
+    // on a readiness edge and tells whether it got past EAGAIN.
+    struct request
+    {
+        std::coroutine_handle<> handle_{};
+        int result_ = 0;
+        bool (*retry_)(request&) = nullptr;
+    };
+
+    // Wait for the fd to become ready after an operation failed with EAGAIN.
+    // May resume spuriously, the operation has to be retried.
+    struct async_ready
+    {
+        [[nodiscard]] auto await_ready() -> bool
+        {
+            if (io_.ring_)
+            {
+                return false;
+            }
+            // An edge seen since the last wait may have been drained already,
+            // retrying costs one syscall and avoids a lost wakeup
+            return std::exchange(io_.ready_flag(fd_, write_), false);
+        }
+        auto await_suspend(std::coroutine_handle<> handle) -> std::coroutine_handle<>
+        {
+            if (io_.ring_)
+            {
+                auto& sqe = io_.prepare(IORING_OP_POLL_ADD, fd_, request_, handle);
+                sqe.poll32_events = write_ ? POLLOUT : POLLIN;
+                return next_ready();
+            }
+            request_.handle_ = handle;
+            io_.park(fd_, write_, request_);
+            return next_ready();
+        }
+        void await_resume()
+        {}
+
+        io_polling& io_;
+        int fd_;
+        bool write_;
+        request request_{};
+    };
+
+    auto readable(int fd) -> async_ready
+    {
+        return async_ready{*this, fd, false};
+    }
+
+    auto writable(int fd) -> async_ready
+    {
+        return async_ready{*this, fd, true};
+    }
+
+    // Awaiter of read(), write() and accept(), resumes with their result
+    struct async_io : request
+    {
+        [[nodiscard]] auto await_ready() -> bool
+        {
+            if (io_.ring_)
+            {
+                return false;
+            }
+            return attempt(*this);
+        }
+        auto await_suspend(std::coroutine_handle<> handle) -> std::coroutine_handle<>
+        {
+            handle_ = handle;
+            if (!io_.ring_)
+            {
+                retry_ = &attempt;
+                io_.park(fd_, opcode_ == IORING_OP_WRITE, *this);
+                return next_ready();
+            }
+            io_.make_blocking(fd_);
+            auto& sqe = io_.prepare(opcode_, fd_, *this, handle);
+            sqe.addr = reinterpret_cast<std::uintptr_t>(data_);
+            sqe.len = static_cast<std::uint32_t>(size_);
+            if (opcode_ == IORING_OP_ACCEPT)
+            {
+                // off shares its storage with addr2, the address length, left null
+                sqe.accept_flags = static_cast<std::uint32_t>(flags_);
+            }
+            else
+            {
+                // Current file position, the only one pipes and sockets have
+                sqe.off = static_cast<std::uint64_t>(-1);
+            }
+            return next_ready();
+        }
+        [[nodiscard]] auto await_resume() const -> int
+        {
+            return result_;
+        }
+
+        // The syscall of the epoll backend, false while it fails with EAGAIN
+        static auto attempt(request& req) -> bool
+        {
+            auto& op = static_cast<async_io&>(req);
+            switch (op.opcode_)
+            {
+            case IORING_OP_READ:
+                op.result_ = syscall_result(::read(op.fd_, const_cast<void*>(op.data_), op.size_));
+                break;
+            case IORING_OP_WRITE:
+                op.result_ = syscall_result(::write(op.fd_, op.data_, op.size_));
+                break;
+            default:
+                op.result_ = syscall_result(::accept4(op.fd_, nullptr, nullptr, op.flags_));
+                break;
+            }
+            return op.result_ != -EAGAIN;
+        }
+
+        io_polling& io_;
+        std::uint8_t opcode_;
+        int fd_;
+        const void* data_;
+        std::size_t size_;
+        int flags_ = 0;
+    };
+
+    // Bytes read, 0 at end of file or a negative errno
+    auto read(int fd, std::span<std::byte> buffer) -> async_io
+    {
+        return async_io{{}, *this, IORING_OP_READ, fd, buffer.data(), buffer.size()};
+    }
+
+    // Bytes written or a negative errno
+    auto write(int fd, std::span<const std::byte> buffer) -> async_io
+    {
+        return async_io{{}, *this, IORING_OP_WRITE, fd, buffer.data(), buffer.size()};
+    }
+
+    // Accepted non-blocking socket or a negative errno
+    auto accept(int fd) -> async_io
+    {
+        return async_io{{}, *this, IORING_OP_ACCEPT, fd, nullptr, 0, SOCK_NONBLOCK | SOCK_CLOEXEC};
+    }
+
+    // Stop watching the fd, to be called before closing it so that its number
+    // can be reused. With epoll the coroutines still waiting on it are resumed,
+    // their operations with -ECANCELED. With io_uring nothing may be in flight
+    // on it.
+    void forget(int fd)
+    {
+        const auto index = static_cast<std::size_t>(fd);
+        if (index >= states_.size())
+        {
+            return;
+        }
+        auto& state = states_[index];
+        if (state.registered_)
+        {
+            ::epoll_ctl(epoll_, EPOLL_CTL_DEL, fd, nullptr);
+            cancel(state.reader_);
+            cancel(state.writer_);
+        }
+        state = fd_state{};
+    }
+
+    // Submit what was prepared, wait up to timeout for events and resume
+    // their coroutines, a negative timeout waits forever. Returns the number
+    // of events processed.
+    auto poll(std::chrono::milliseconds timeout) -> std::size_t
+    {
+        if (ring_)
+        {
+            return poll_ring(timeout);
+        }
+        const int count = ::epoll_wait(epoll_, events_.data(), static_cast<int>(events_.size()),
+                                       static_cast<int>(timeout.count()));
+        if (count < 0)
+        {
+            if (errno == EINTR)
+            {
+                return 0;
+            }
+            throw std::system_error(errno, std::generic_category(), "epoll_wait");
+        }
+        for (const auto& event : std::span{events_}.first(static_cast<std::size_t>(count)))
+        {
+            auto& state = states_[static_cast<std::size_t>(event.data.fd)];
+            // Errors and hang ups wake both sides, their next call reports it
+            constexpr auto failed = EPOLLERR | EPOLLHUP;
+            if ((event.events & (EPOLLIN | EPOLLRDHUP | failed)) != 0U)
+            {
+                notify(state.reader_, state.readable_);
+            }
+            if ((event.events & (EPOLLOUT | failed)) != 0U)
+            {
+                notify(state.writer_, state.writable_);
+            }
+        }
+        return static_cast<std::size_t>(count);
+    }
+
+    // Drive the calling thread: resume ready coroutines, fire its timers and
+    // wait for events. Returns once nothing is runnable, armed nor waiting.
+    void run()
+    {
+        auto& queue = ready_queue();
+        auto& wheel = timers();
+        while (true)
+        {
+            while (!queue.empty())
+            {
+                auto handle = queue.front();
+                queue.pop_front();
+                handle.resume();
+            }
+            if (!wheel.empty())
+            {
+                wheel.advance();
+                if (!queue.empty())
+                {
+                    continue;
+                }
+            }
+            if (waiting_ == 0 && wheel.empty())
+            {
+                return;
+            }
+            poll(wheel.empty() ? std::chrono::milliseconds{-1}
+                               : std::chrono::duration_cast<std::chrono::milliseconds>(
+                                     timer_wheel::resolution));
+        }
+    }
+
+private:
+    static auto syscall_result(ssize_t result) -> int
+    {
+        return result >= 0 ? static_cast<int>(result) : -errno;
+    }
+
+    // Resume the coroutine of a completion
+    auto completed()
+    {
+        return [this](std::uint64_t user_data, int result) {
+            if (user_data == 0)
+            {
+                timeout_armed_ = false;
+                return;
+            }
+            auto& req = *reinterpret_cast<request*>(user_data);
+            req.result_ = result;
+            --waiting_;
+            schedule(req.handle_);
+        };
+    }
+
+    struct fd_state
+    {
+        request* reader_ = nullptr;
+        request* writer_ = nullptr;
+        bool readable_ = false;
+        bool writable_ = false;
+        bool registered_ = false;
+        bool blocking_ = false;
+    };
+
+    auto prepare(std::uint8_t opcode, int fd, request& req, std::coroutine_handle<> handle)
+        -> io_uring_sqe&
+    {
+        req.handle_ = handle;
+        auto& sqe = ring_->prepare(completed());
+        sqe.opcode = opcode;
+        sqe.fd = fd;
+        sqe.user_data = reinterpret_cast<std::uintptr_t>(&req);
+        ++waiting_;
+        return sqe;
+    }
+
+    auto poll_ring(std::chrono::milliseconds timeout) -> std::size_t
+    {
+        if (timeout.count() > 0 && !timeout_armed_)
+        {
+            // Bounds the wait, its completion has no request
+            timeout_.tv_sec = timeout.count() / 1000;
+            timeout_.tv_nsec = (timeout.count() % 1000) * 1000000;
+            auto& sqe = ring_->prepare(completed());
+            sqe.opcode = IORING_OP_TIMEOUT;
+            sqe.addr = reinterpret_cast<std::uintptr_t>(&timeout_);
+            sqe.len = 1;
+            timeout_armed_ = true;
+        }
+        ring_->submit(timeout.count() != 0 ? 1 : 0);
+        return ring_->reap(completed());
+    }
+
+    auto state_of(int fd) -> fd_state&
+    {
+        const auto index = static_cast<std::size_t>(fd);
+        if (index >= states_.size())
+        {
+            states_.resize(index + 1);
+        }
+        return states_[index];
+    }
+
+    // Once per fd, io_uring then polls it internally and one entry completes
+    // the transfer
+    void make_blocking(int fd)
+    {
+        auto& state = state_of(fd);
+        if (state.blocking_)
+        {
+            return;
+        }
+        const int flags = ::fcntl(fd, F_GETFL);
+        if (flags >= 0 && (flags & O_NONBLOCK) != 0)
+        {
+            ::fcntl(fd, F_SETFL, flags & ~O_NONBLOCK);
+        }
+        state.blocking_ = true;
+    }
+
+    // Register the fd on first use
+    auto ready_flag(int fd, bool write) -> bool&
+    {
+        auto& state = state_of(fd);
+        if (!state.registered_)
+        {
+            epoll_event event{};
+            event.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+            event.data.fd = fd;
+            if (::epoll_ctl(epoll_, EPOLL_CTL_ADD, fd, &event) < 0)
+            {
+                throw std::system_error(errno, std::generic_category(), "epoll_ctl");
+            }
+            state.registered_ = true;
+        }
+        return write ? state.writable_ : state.readable_;
+    }
+
+    // Wait for the next edge, one seen before only predates the EAGAIN
+    void park(int fd, bool write, request& req)
+    {
+        ready_flag(fd, write) = false;
+        auto& state = states_[static_cast<std::size_t>(fd)];
+        (write ? state.writer_ : state.reader_) = &req;
+        ++waiting_;
+    }
+
+    void notify(request*& waiter, bool& ready)
+    {
+        if (waiter == nullptr)
+        {
+            ready = true;
+        }
+        else if (waiter->retry_ == nullptr || waiter->retry_(*waiter))
+        {
+            wake(waiter);
+        }
+    }
+
+    void cancel(request*& waiter)
+    {
+        if (waiter != nullptr)
+        {
+            waiter->result_ = -ECANCELED;
+            wake(waiter);
+        }
+    }
+
+    void wake(request*& waiter)
+    {
+        if (waiter != nullptr)
+        {
+            --waiting_;
+            schedule(std::exchange(waiter, nullptr)->handle_);
+        }
+    }
+
+    static constexpr std::size_t max_events = 256;
+    static constexpr unsigned ring_entries = 256;
+
+    std::unique_ptr<uring> ring_{};
+    __kernel_timespec timeout_{};
+    bool timeout_armed_ = false;
+    int epoll_ = -1;
+    // Coroutines waiting on an fd or an operation
+    std::size_t waiting_ = 0;
+    std::vector<fd_state> states_{};
+    std::array<epoll_event, max_events> events_{};
+};
@@ -1,4 +1,4 @@
-#include <iostream>
+#pragma once
 ////////////////////////////////////////////////////////////////
 // Reference implementation of std::lazy proposal D2506R0 https://wg21.link/p2506r0.
 // https://godbolt.org/z/dxxavazPa
@@ -13,6 +13,8 @@
 #include <type_traits>
 #include <utility>
 
+#include "trace.hh"
+
 #ifdef _MSC_VER
 #define _EMPTY_BASES __declspec(empty_bases)
 #ifdef __clang__
@@ -380,6 +382,7 @@ private:
             static_assert(is_pointer_interconvertible_base_of_v<_Lazy_promise_base, _Promise>);
 #endif // __cpp_lib_is_pointer_interconvertible
 
+            ::trace(::trace_event::lazy_finish, _Coro.address(), _Coro.address());
             _Lazy_promise_base& _Current = _Coro.promise();
             return _Current._Cont ? _Current._Cont : ::std::noop_coroutine();
         }
@@ -400,6 +403,7 @@ private:
         [[nodiscard]] coroutine_handle<_Lazy_promise_base>
         await_suspend(coroutine_handle<> _Cont) noexcept
         {
+            ::trace(::trace_event::lazy_start, _Coro.address(), _Coro.address());
             _Coro.promise()._Cont = _Cont;
             return _Coro;
         }
@@ -515,6 +519,7 @@ private:
             static_assert(is_pointer_interconvertible_base_of_v<_Lazy_promise_base, _Promise>);
 #endif // __cpp_lib_is_pointer_interconvertible
 
+            ::trace(::trace_event::lazy_finish, _Coro.address(), _Coro.address());
             _Lazy_promise_base& _Current = _Coro.promise();
             return _Current._Cont ? _Current._Cont : ::std::noop_coroutine();
         }
@@ -535,6 +540,7 @@ private:
         [[nodiscard]] coroutine_handle<_Lazy_promise_base>
         await_suspend(coroutine_handle<> _Cont) noexcept
         {
+            ::trace(::trace_event::lazy_start, _Coro.address(), _Coro.address());
             _Coro.promise()._Cont = _Cont;
             return _Coro;
         }
@@ -615,9 +621,7 @@ public:
                "sync_await requires the lazy object to be associated with a coroutine "
                "suspended at its initial suspend point");
 
-        cout << "task::await_suspend\n";
         _Simple.await_suspend(::std::noop_coroutine()).resume();
-        cout << "task::await_resume\n";
 
         return _Simple.await_resume();
     }
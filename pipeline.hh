@@ -0,0 +1,223 @@
+#pragma once
+
+#include <cassert>
+#include <cstddef>
+#include <functional>
+#include <memory>
+#include <optional>
+#include <span>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "channel.hh"
+#include "lazy.hh"
+#include "select.hh"
+
+// Stages between channels. map and filter are plain functions from a value to
+// an optional result, stages joined with | are fused at compile time into one
+// function, so that pipeline runs the whole chain in a single coroutine with one
+// recv and one send per value instead of a channel hop per stage.
+//
+//     auto task = pipeline(lines, records, map(parse) | filter(valid) | map(enrich));
+//
+// pipeline, fan_out, fan_in and batch close their output once their inputs are
+// closed and drained.
+
+template <typename Function>
+struct map_stage
+{
+    template <typename In>
+    auto operator()(In&& value)
+        -> std::optional<std::remove_cvref_t<std::invoke_result_t<Function&, In&&>>>
+    {
+        return std::invoke(function_, std::forward<In>(value));
+    }
+
+    Function function_;
+};
+
+template <typename Predicate>
+struct filter_stage
+{
+    template <typename In>
+    auto operator()(In&& value) -> std::optional<std::decay_t<In>>
+    {
+        if (std::invoke(predicate_, std::as_const(value)))
+        {
+            return std::forward<In>(value);
+        }
+        return std::nullopt;
+    }
+
+    Predicate predicate_;
+};
+
+// Second runs on what First let through, without a channel in between
+template <typename First, typename Second>
+struct fused_stage
+{
+    template <typename In>
+    auto operator()(In&& value)
+    {
+        using result = decltype(second_(std::move(*first_(std::forward<In>(value)))));
+        if (auto out = first_(std::forward<In>(value)))
+        {
+            return second_(std::move(*out));
+        }
+        return result{};
+    }
+
+    First first_;
+    Second second_;
+};
+
+template <typename Function>
+auto map(Function function) -> map_stage<Function>
+{
+    return {std::move(function)};
+}
+
+template <typename Predicate>
+auto filter(Predicate predicate) -> filter_stage<Predicate>
+{
+    return {std::move(predicate)};
+}
+
+template <typename Stage>
+inline constexpr bool is_stage = false;
+template <typename Function>
+inline constexpr bool is_stage<map_stage<Function>> = true;
+template <typename Predicate>
+inline constexpr bool is_stage<filter_stage<Predicate>> = true;
+template <typename First, typename Second>
+inline constexpr bool is_stage<fused_stage<First, Second>> = true;
+
+template <typename First, typename Second>
+    requires(is_stage<First> && is_stage<Second>)
+auto operator|(First first, Second second) -> fused_stage<First, Second>
+{
+    return {std::move(first), std::move(second)};
+}
+
+// The last of several coroutines sharing an output closes it
+template <typename Out, typename Policy>
+struct stage_closer
+{
+    ~stage_closer()
+    {
+        out_->close();
+    }
+
+    std::shared_ptr<channel<Out, Policy>> out_;
+};
+
+template <typename In, typename Out, typename Policy, typename Stage>
+auto run_stage(std::shared_ptr<channel<In, Policy>> in, std::shared_ptr<channel<Out, Policy>> out,
+               Stage stage, std::shared_ptr<stage_closer<Out, Policy>> done) -> std::lazy<void>
+{
+    while (auto value = co_await in->recv_optional())
+    {
+        if (auto result = stage(std::move(*value)))
+        {
+            co_await out->send(std::move(*result));
+        }
+    }
+    // Close out when the last one returns, not when its frame is destroyed
+    done.reset();
+}
+
+// One coroutine receiving from in and sending what stage let through to out
+template <typename In, typename Out, typename Policy, typename Stage>
+auto pipeline(std::shared_ptr<channel<In, Policy>> in,
+              std::shared_ptr<channel<Out, Policy>> out, Stage stage) -> std::lazy<void>
+{
+    auto done = std::make_shared<stage_closer<Out, Policy>>(out);
+    return run_stage(std::move(in), std::move(out), std::move(stage), std::move(done));
+}
+
+// Workers copies of the stage share in and out, out is closed by the last one
+template <typename In, typename Out, typename Policy, typename Stage>
+auto fan_out(std::shared_ptr<channel<In, Policy>> in, std::shared_ptr<channel<Out, Policy>> out,
+             Stage stage, std::size_t workers) -> std::vector<std::lazy<void>>
+{
+    assert(workers > 0 && "fan_out needs at least one worker");
+    auto done = std::make_shared<stage_closer<Out, Policy>>(out);
+    std::vector<std::lazy<void>> tasks{};
+    tasks.reserve(workers);
+    for (std::size_t i = 0; i < workers; ++i)
+    {
+        tasks.push_back(run_stage(in, out, stage, done));
+    }
+    return tasks;
+}
+
+// One coroutine per input, all sending to out through their own copy of the
+// stage, out is closed once every input is
+template <typename In, typename Out, typename Policy, typename Stage = map_stage<std::identity>>
+auto fan_in(std::vector<std::shared_ptr<channel<In, Policy>>> ins,
+            std::shared_ptr<channel<Out, Policy>> out, Stage stage = {})
+    -> std::vector<std::lazy<void>>
+{
+    assert(!ins.empty() && "fan_in needs at least one input");
+    auto done = std::make_shared<stage_closer<Out, Policy>>(out);
+    std::vector<std::lazy<void>> tasks{};
+    tasks.reserve(ins.size());
+    for (auto& in : ins)
+    {
+        tasks.push_back(run_stage(std::move(in), out, stage, done));
+    }
+    return tasks;
+}
+
+// Group values by size, the last batch may be smaller. Values are moved out of
+// the buffer by recv_many, a batch parks at most once per missing chunk.
+// Vectors the consumer is done with can be given back on spare, a batch is
+// then filled in one of them instead of a new allocation, like Effective Go's
+// leaky buffer: nothing waits on spare and what does not fit is dropped.
+//
+//     auto [values, ok] = co_await batches->recv();
+//     values.clear();
+//     spare->try_send(std::move(values));
+template <typename Type, typename Policy>
+auto batch(std::shared_ptr<channel<Type, Policy>> in,
+           std::shared_ptr<channel<std::vector<Type>, Policy>> out, std::size_t size,
+           std::shared_ptr<channel<std::vector<Type>, Policy>> spare = nullptr)
+    -> std::lazy<void>
+{
+    assert(size > 0 && "batch needs a size");
+    std::vector<Type> values(size);
+    std::size_t count = 0;
+    while (true)
+    {
+        const auto received =
+            co_await in->recv_many(std::span<Type>{values}.subspan(count));
+        count += received;
+        if (received == 0 || count == size)
+        {
+            if (count > 0)
+            {
+                values.resize(count);
+                co_await out->send(std::move(values));
+                values = {};
+                if (spare)
+                {
+                    auto reuse = spare->recv();
+                    const auto ready = co_await select(reuse, select_default);
+                    if (ready == 0)
+                    {
+                        values = std::get<0>(reuse.await_resume());
+                    }
+                }
+                values.resize(size);
+                count = 0;
+            }
+            if (received == 0)
+            {
+                break;
+            }
+        }
+    }
+    out->close();
+}
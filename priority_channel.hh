@@ -0,0 +1,362 @@
+#pragma once
+
+#include <array>
+#include <bit>
+#include <cassert>
+#include <coroutine>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <optional>
+#include <stdexcept>
+#include <tuple>
+#include <utility>
+
+#include "channel.hh"
+#include "executor.hh"
+#include "ring_buffer.hh"
+#include "trace.hh"
+
+// Channel handing out the most urgent pending value first. Each of the Levels
+// priorities has its own ring and its own list of parked senders, values of
+// one priority stay in order. Two bit masks tell which levels hold a buffered
+// value or a parked sender, so that recv finds the most urgent one with a
+// single bit scan instead of walking the levels.
+//
+//     priority_channel<message, 2> inbox{64};
+//     co_await inbox.send(bulk);
+//     co_await inbox.send(control, inbox.highest);
+//
+// send/recv/recv_optional/try_send/close behave like channel, select,
+// deadlines, stop tokens and batches are not available. buffer_size bounds
+// the values buffered over all levels, every ring is allocated for it up
+// front.
+template <typename Type, std::size_t Levels, typename Policy = single_thread>
+class priority_channel
+{
+    static_assert(Levels > 0 && Levels <= 64, "one bit per level in a 64 bit mask");
+
+public:
+    using lock_type = typename Policy::lock_type;
+    using priority_type = std::size_t;
+
+    static constexpr priority_type lowest = 0;
+    static constexpr priority_type highest = Levels - 1;
+
+    explicit priority_channel(std::size_t buffer_size = 0)
+        : buffer_size_{buffer_size}
+        , rings_{make_rings(buffer_size, std::make_index_sequence<Levels>{})}
+    {}
+
+    priority_channel(const priority_channel&) = delete;
+    auto operator=(const priority_channel&) -> priority_channel& = delete;
+
+    struct async_recv : public IntrusiveNode<async_recv>
+    {
+        explicit async_recv(priority_channel& channel) : channel_{channel}
+        {}
+
+        [[nodiscard]] auto await_ready() -> bool
+        {
+            std::lock_guard lock{channel_.lock_};
+            // Taking from the buffer wakes nobody while no sender is parked
+            if (channel_.waiting_ == 0 && channel_.buffered_ != 0)
+            {
+                std::coroutine_handle<> woken{};
+                channel_.take(data_, woken);
+                return true;
+            }
+            return channel_.closed_;
+        }
+        auto await_suspend(std::coroutine_handle<> handle) -> std::coroutine_handle<>
+        {
+            std::lock_guard lock{channel_.lock_};
+            std::coroutine_handle<> woken{};
+            if (channel_.take(data_, woken) || channel_.closed_)
+            {
+                return transfer(handle, woken);
+            }
+            handle_ = handle;
+            channel_.receivers_.push(this);
+            trace(trace_event::park, &channel_, handle.address());
+            return next_ready();
+        }
+        auto await_resume()
+        {
+            if (data_)
+            {
+                return std::make_tuple(std::move(*data_), true);
+            }
+            if (!channel_.closed())
+            {
+                throw std::runtime_error("unexpected await resume");
+            }
+            return std::make_tuple(Type{}, false);
+        }
+
+        priority_channel& channel_;
+        std::optional<Type> data_{};
+        std::coroutine_handle<> handle_{};
+    };
+    auto recv() -> async_recv
+    {
+        return async_recv{*this};
+    }
+
+    // Receive like recv() but resume with the value, or with nothing once the
+    // channel is closed
+    struct async_recv_optional : public async_recv
+    {
+        using async_recv::async_recv;
+
+        auto await_resume() -> std::optional<Type>
+        {
+            return std::move(this->data_);
+        }
+    };
+    auto recv_optional() -> async_recv_optional
+    {
+        return async_recv_optional{*this};
+    }
+
+    // Resumes with true once the value was handed to a receiver or buffered,
+    // false when the channel was closed first and the value dropped
+    struct async_send : public IntrusiveNode<async_send>
+    {
+        async_send(priority_channel& channel, Type&& data, priority_type priority)
+            : channel_{channel}, data_{std::move(data)}, priority_{priority}
+        {
+            assert(priority < Levels && "priority out of range");
+        }
+
+        [[nodiscard]] auto await_ready() -> bool
+        {
+            std::lock_guard lock{channel_.lock_};
+            // Buffering wakes nobody while no receiver is parked
+            if (channel_.closed_)
+            {
+                return true;
+            }
+            if (channel_.receivers_.empty() && !channel_.full())
+            {
+                channel_.buffer(*this);
+                return true;
+            }
+            return false;
+        }
+        auto await_suspend(std::coroutine_handle<> handle) -> std::coroutine_handle<>
+        {
+            std::lock_guard lock{channel_.lock_};
+            std::coroutine_handle<> woken{};
+            if (channel_.closed_ || channel_.exchange(*this, woken))
+            {
+                return transfer(handle, woken);
+            }
+            handle_ = handle;
+            channel_.senders_[priority_].push(this);
+            channel_.waiting_ |= bit(priority_);
+            trace(trace_event::park, &channel_, handle.address());
+            return next_ready();
+        }
+        auto await_resume() -> bool
+        {
+            return sent_;
+        }
+
+        priority_channel& channel_;
+        Type data_;
+        priority_type priority_;
+        std::coroutine_handle<> handle_{};
+        bool sent_ = false;
+    };
+    auto send(Type value, priority_type priority = lowest) -> async_send
+    {
+        return async_send{*this, std::move(value), priority};
+    }
+
+    // Send without waiting. False when the value could not be handed to a
+    // receiver nor buffered, or the channel is closed.
+    auto try_send(Type value, priority_type priority = lowest) -> bool
+    {
+        async_send send{*this, std::move(value), priority};
+        std::coroutine_handle<> woken{};
+        {
+            std::lock_guard lock{lock_};
+            if (closed_ || !exchange(send, woken))
+            {
+                return false;
+            }
+        }
+        if (woken)
+        {
+            schedule(woken);
+        }
+        return true;
+    }
+
+    // Wake every parked receiver and sender, senders resume with false and
+    // their value dropped. Values already buffered can still be received.
+    void close()
+    {
+        std::lock_guard lock{lock_};
+        if (std::exchange(closed_, true))
+        {
+            return;
+        }
+        trace(trace_event::close, this);
+        while (auto* recv = receivers_.pop())
+        {
+            trace(trace_event::wake, this, recv->handle_.address());
+            schedule(recv->handle_);
+        }
+        for (auto& senders : senders_)
+        {
+            while (auto* send = senders.pop())
+            {
+                trace(trace_event::wake, this, send->handle_.address());
+                schedule(send->handle_);
+            }
+        }
+        waiting_ = 0;
+    }
+
+    [[nodiscard]] auto closed() const -> bool
+    {
+        std::lock_guard lock{lock_};
+        return closed_;
+    }
+
+private:
+    template <std::size_t... Level>
+    static auto make_rings(std::size_t buffer_size, std::index_sequence<Level...>)
+        -> std::array<ring_buffer<Type>, Levels>
+    {
+        return {((void)Level, ring_buffer<Type>{buffer_size})...};
+    }
+
+    static constexpr auto bit(priority_type priority) -> std::uint64_t
+    {
+        return std::uint64_t{1} << priority;
+    }
+
+    // Most urgent level set in mask, which must not be empty
+    static auto top(std::uint64_t mask) -> priority_type
+    {
+        return static_cast<priority_type>(std::bit_width(mask)) - 1;
+    }
+
+    // Run the woken peer right away and queue the calling coroutine behind it
+    static auto transfer(std::coroutine_handle<> self, std::coroutine_handle<> woken)
+        -> std::coroutine_handle<>
+    {
+        if (!woken)
+        {
+            return self;
+        }
+        schedule(self);
+        return woken;
+    }
+
+    auto full() const -> bool
+    {
+        return size_ >= buffer_size_;
+    }
+
+    // Lock must be held and the buffer not full
+    void buffer(async_send& send)
+    {
+        rings_[send.priority_].push_back(std::move(send.data_));
+        send.sent_ = true;
+        buffered_ |= bit(send.priority_);
+        ++size_;
+    }
+
+    // The most urgent value, buffered ones before the parked senders of the
+    // same level, lock must be held. False when there is none.
+    auto take(std::optional<Type>& out, std::coroutine_handle<>& woken) -> bool
+    {
+        if ((buffered_ | waiting_) == 0)
+        {
+            return false;
+        }
+        const auto level = top(buffered_ | waiting_);
+        auto& ring = rings_[level];
+        if (!ring.empty())
+        {
+            out.emplace(std::move(ring.front()));
+            ring.pop_front();
+            --size_;
+            if (ring.empty())
+            {
+                buffered_ &= ~bit(level);
+            }
+            woken = refill();
+            return true;
+        }
+        // Unbuffered channel, or a level whose values are all parked
+        auto* send = pop_sender(level);
+        out.emplace(std::move(send->data_));
+        send->sent_ = true;
+        trace(trace_event::handoff, this, send->handle_.address());
+        trace(trace_event::wake, this, send->handle_.address());
+        woken = send->handle_;
+        return true;
+    }
+
+    // Give the value to a parked receiver or buffer it, lock must be held.
+    // False when the sender has to park.
+    auto exchange(async_send& send, std::coroutine_handle<>& woken) -> bool
+    {
+        if (auto* recv = receivers_.pop())
+        {
+            // A receiver only parks on an empty buffer
+            recv->data_.emplace(std::move(send.data_));
+            send.sent_ = true;
+            trace(trace_event::handoff, this, recv->handle_.address());
+            trace(trace_event::wake, this, recv->handle_.address());
+            woken = recv->handle_;
+            return true;
+        }
+        if (full())
+        {
+            return false;
+        }
+        buffer(send);
+        return true;
+    }
+
+    // The slot freed by a recv goes to the most urgent parked sender
+    auto refill() -> std::coroutine_handle<>
+    {
+        if (waiting_ == 0 || full())
+        {
+            return nullptr;
+        }
+        auto* send = pop_sender(top(waiting_));
+        buffer(*send);
+        trace(trace_event::wake, this, send->handle_.address());
+        return send->handle_;
+    }
+
+    auto pop_sender(priority_type level) -> async_send*
+    {
+        auto& senders = senders_[level];
+        auto* send = senders.pop();
+        if (senders.empty())
+        {
+            waiting_ &= ~bit(level);
+        }
+        return send;
+    }
+
+    std::size_t buffer_size_;
+    std::size_t size_ = 0;
+    // Levels with a buffered value, levels with a parked sender
+    std::uint64_t buffered_ = 0;
+    std::uint64_t waiting_ = 0;
+    std::array<ring_buffer<Type>, Levels> rings_;
+    FIFOList<async_recv> receivers_{};
+    std::array<FIFOList<async_send>, Levels> senders_{};
+    bool closed_ = false;
+    mutable lock_type lock_{};
+};
@@ -0,0 +1,266 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <cstddef>
+#include <memory>
+#include <new>
+#include <utility>
+
+inline constexpr std::size_t cache_line_size = 64;
+
+// FIFO storage allocated once at construction. The capacity is rounded up to a
+// power of two so that wrapping an index is a mask, head and tail grow forever
+// and live on their own cache line.
+template <typename Type>
+class ring_buffer
+{
+public:
+    explicit ring_buffer(std::size_t capacity)
+        : capacity_{capacity == 0 ? 0 : std::bit_ceil(capacity)}
+        , slots_{capacity_ == 0 ? nullptr : allocator_.allocate(capacity_)}
+    {}
+
+    ring_buffer(const ring_buffer&) = delete;
+    auto operator=(const ring_buffer&) -> ring_buffer& = delete;
+
+    ~ring_buffer()
+    {
+        while (!empty())
+        {
+            pop_front();
+        }
+        if (slots_ != nullptr)
+        {
+            allocator_.deallocate(slots_, capacity_);
+        }
+    }
+
+    [[nodiscard]] auto front() -> Type&
+    {
+        return slots_[head_ & (capacity_ - 1)];
+    }
+
+    void pop_front()
+    {
+        std::destroy_at(&front());
+        ++head_;
+    }
+
+    template <typename... Args>
+    auto emplace_back(Args&&... args) -> Type&
+    {
+        if (size() == capacity_)
+        {
+            // Only reached by users not bounding the size themselves
+            grow();
+        }
+        auto* slot = &slots_[tail_ & (capacity_ - 1)];
+        std::construct_at(slot, std::forward<Args>(args)...);
+        ++tail_;
+        return *slot;
+    }
+
+    void push_back(Type&& value)
+    {
+        emplace_back(std::move(value));
+    }
+
+    void push_back(const Type& value)
+    {
+        emplace_back(value);
+    }
+
+    // Move the count oldest values into the already constructed objects at out
+    void move_front(Type* out, std::size_t count)
+    {
+        const std::size_t index = head_ & (capacity_ - 1);
+        const std::size_t first = std::min(count, capacity_ - index);
+        std::move(slots_ + index, slots_ + index + first, out);
+        std::destroy(slots_ + index, slots_ + index + first);
+        std::move(slots_, slots_ + (count - first), out + first);
+        std::destroy(slots_, slots_ + (count - first));
+        head_ += count;
+    }
+
+    // Move construct count values from first at the back, trivially copyable
+    // values end up as at most two memmove
+    void push_back_n(Type* first, std::size_t count)
+    {
+        while (size() + count > capacity_)
+        {
+            grow();
+        }
+        const std::size_t index = tail_ & (capacity_ - 1);
+        const std::size_t split = std::min(count, capacity_ - index);
+        std::uninitialized_move(first, first + split, slots_ + index);
+        std::uninitialized_move(first + split, first + count, slots_);
+        tail_ += count;
+    }
+
+    [[nodiscard]] auto size() const -> std::size_t
+    {
+        return tail_ - head_;
+    }
+
+    [[nodiscard]] auto empty() const -> bool
+    {
+        return head_ == tail_;
+    }
+
+    [[nodiscard]] auto capacity() const -> std::size_t
+    {
+        return capacity_;
+    }
+
+private:
+    void grow()
+    {
+        const std::size_t capacity = std::max<std::size_t>(capacity_ * 2, 1);
+        Type* slots = allocator_.allocate(capacity);
+        std::size_t count = 0;
+        for (; !empty(); ++count)
+        {
+            std::construct_at(&slots[count], std::move(front()));
+            pop_front();
+        }
+        if (slots_ != nullptr)
+        {
+            allocator_.deallocate(slots_, capacity_);
+        }
+        slots_ = slots;
+        capacity_ = capacity;
+        head_ = 0;
+        tail_ = count;
+    }
+
+    alignas(cache_line_size) std::size_t head_ = 0;
+    alignas(cache_line_size) std::size_t tail_ = 0;
+    alignas(cache_line_size) std::size_t capacity_;
+    [[no_unique_address]] std::allocator<Type> allocator_{};
+    Type* slots_;
+};
+
+// Uninitialized room for one value, its owner constructs and destroys value_
+template <typename Type>
+union storage_for
+{
+    storage_for()
+    {}
+    ~storage_for()
+    {}
+    storage_for(const storage_for&) = delete;
+    auto operator=(const storage_for&) -> storage_for& = delete;
+
+    Type value_;
+};
+
+// FIFO storage inside the object for a power of two capacity known at compile
+// time, it never allocates and wrapping an index is a constant mask. Without
+// the cache line padding of ring_buffer so that it fits a coroutine frame or
+// the stack. Callers bound the size, nothing grows.
+template <typename Type, std::size_t Capacity>
+class inline_ring_buffer
+{
+    static_assert(std::has_single_bit(Capacity), "the capacity must be a power of two");
+
+public:
+    inline_ring_buffer() = default;
+
+    inline_ring_buffer(const inline_ring_buffer&) = delete;
+    auto operator=(const inline_ring_buffer&) -> inline_ring_buffer& = delete;
+
+    ~inline_ring_buffer()
+    {
+        while (!empty())
+        {
+            pop_front();
+        }
+    }
+
+    [[nodiscard]] auto front() -> Type&
+    {
+        return slot(head_);
+    }
+
+    void pop_front()
+    {
+        std::destroy_at(&front());
+        ++head_;
+    }
+
+    [[nodiscard]] auto back() -> Type&
+    {
+        return slot(tail_ - 1);
+    }
+
+    void pop_back()
+    {
+        std::destroy_at(&back());
+        --tail_;
+    }
+
+    template <typename... Args>
+    auto emplace_back(Args&&... args) -> Type&
+    {
+        auto* value = std::construct_at(&slot(tail_), std::forward<Args>(args)...);
+        ++tail_;
+        return *value;
+    }
+
+    void push_back(Type&& value)
+    {
+        emplace_back(std::move(value));
+    }
+
+    void push_back(const Type& value)
+    {
+        emplace_back(value);
+    }
+
+    // Move the count oldest values into the already constructed objects at out
+    void move_front(Type* out, std::size_t count)
+    {
+        for (std::size_t i = 0; i < count; ++i)
+        {
+            out[i] = std::move(front());
+            pop_front();
+        }
+    }
+
+    // Move construct count values from first at the back
+    void push_back_n(Type* first, std::size_t count)
+    {
+        for (std::size_t i = 0; i < count; ++i)
+        {
+            emplace_back(std::move(first[i]));
+        }
+    }
+
+    [[nodiscard]] auto size() const -> std::size_t
+    {
+        return tail_ - head_;
+    }
+
+    [[nodiscard]] auto empty() const -> bool
+    {
+        return head_ == tail_;
+    }
+
+    [[nodiscard]] static constexpr auto capacity() -> std::size_t
+    {
+        return Capacity;
+    }
+
+private:
+    // The value in the slot, only alive between head and tail
+    auto slot(std::size_t index) -> Type&
+    {
+        return slots_[index & (Capacity - 1)].value_;
+    }
+
+    std::size_t head_ = 0;
+    std::size_t tail_ = 0;
+    std::array<storage_for<Type>, Capacity> slots_;
+};
@@ -0,0 +1,235 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <coroutine>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <numeric>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+
+#include "channel.hh"
+
+// Case of a select taken when no other case is ready, like Go's default
+struct select_default_t
+{
+};
+inline constexpr select_default_t select_default{};
+
+// Wait on several channel operations at once and complete exactly one of them.
+// The cases are the usual recv()/send() awaiters, the result of the winning one
+// is read with its await_resume() once the select returned its index.
+//
+//     auto recv_a = chan_a->recv();
+//     auto send_b = chan_b->send(42);
+//     switch (co_await select(recv_a, send_b))
+//     ...
+//
+// A blocked select parks one waiter per case, all of them resuming the same
+// coroutine, and the first channel claiming one of them wins. Ready cases are
+// polled in a random order so that no channel starves the others.
+template <typename... Cases>
+class select_awaiter
+{
+public:
+    static_assert(sizeof...(Cases) > 0, "select needs at least one case");
+
+    explicit select_awaiter(Cases&... cases) : cases_{cases...}
+    {}
+
+    [[nodiscard]] auto await_ready() const -> bool
+    {
+        return false;
+    }
+
+    auto await_suspend(std::coroutine_handle<> handle) -> std::coroutine_handle<>
+    {
+        // Work on copies, once a case completed this awaiter may be resumed and
+        // destroyed by another thread before the last lock is released
+        const auto locks = sorted_locks();
+        lock_all(locks);
+        for (const auto index : shuffled())
+        {
+            std::coroutine_handle<> next = nullptr;
+            winner_ = index;
+            visit(index, [&](auto& select_case) {
+                if constexpr (!is_default<decltype(select_case)>)
+                {
+                    next = select_case.select_try(handle);
+                }
+            });
+            if (next)
+            {
+                unlock_all(locks);
+                return next;
+            }
+        }
+        if constexpr (default_index != select_state::none)
+        {
+            winner_ = default_index;
+            unlock_all(locks);
+            return handle;
+        }
+        parked_ = true;
+        for (std::size_t index = 0; index < sizeof...(Cases); ++index)
+        {
+            visit(index, [&](auto& select_case) {
+                if constexpr (!is_default<decltype(select_case)>)
+                {
+                    select_case.select_park(state_, index, handle);
+                }
+            });
+        }
+        auto next = next_ready();
+        unlock_all(locks);
+        return next;
+    }
+
+    auto await_resume() -> std::size_t
+    {
+        if (!parked_)
+        {
+            return winner_;
+        }
+        // The other channels may still reference our waiters
+        const auto winner = state_.winner();
+        const auto locks = sorted_locks();
+        lock_all(locks);
+        for (std::size_t index = 0; index < sizeof...(Cases); ++index)
+        {
+            visit(index, [&](auto& select_case) {
+                if constexpr (!is_default<decltype(select_case)>)
+                {
+                    if (index != winner)
+                    {
+                        select_case.select_unpark();
+                    }
+                }
+            });
+        }
+        unlock_all(locks);
+        return winner;
+    }
+
+private:
+    template <typename Case>
+    static constexpr bool is_default = std::is_same_v<std::remove_cvref_t<Case>, select_default_t>;
+
+    static constexpr auto find_default() -> std::size_t
+    {
+        constexpr std::array<bool, sizeof...(Cases)> defaults{is_default<Cases>...};
+        for (std::size_t i = 0; i < defaults.size(); ++i)
+        {
+            if (defaults[i])
+            {
+                return i;
+            }
+        }
+        return select_state::none;
+    }
+    static constexpr std::size_t default_index = find_default();
+
+    struct lock_entry
+    {
+        void* lock_ = nullptr;
+        void (*acquire_)(void*) = nullptr;
+        void (*release_)(void*) = nullptr;
+    };
+
+    struct lock_set
+    {
+        std::array<lock_entry, sizeof...(Cases)> entries_{};
+        std::size_t size_ = 0;
+    };
+
+    template <typename Func>
+    void visit(std::size_t index, Func&& func)
+    {
+        [&]<std::size_t... I>(std::index_sequence<I...>) {
+            ((index == I ? func(std::get<I>(cases_)) : void()), ...);
+        }(std::index_sequence_for<Cases...>{});
+    }
+
+    // Channels are always locked in address order so that two selects sharing
+    // channels cannot deadlock, a channel appearing twice is locked once
+    auto sorted_locks() -> lock_set
+    {
+        lock_set locks{};
+        for (std::size_t index = 0; index < sizeof...(Cases); ++index)
+        {
+            visit(index, [&](auto& select_case) {
+                if constexpr (!is_default<decltype(select_case)>)
+                {
+                    using lock_type = std::remove_pointer_t<decltype(select_case.select_lock())>;
+                    if constexpr (!std::is_same_v<lock_type, null_lock>)
+                    {
+                        locks.entries_[locks.size_++] = lock_entry{
+                            select_case.select_lock(),
+                            [](void* lock) { static_cast<lock_type*>(lock)->lock(); },
+                            [](void* lock) { static_cast<lock_type*>(lock)->unlock(); }};
+                    }
+                }
+            });
+        }
+        auto end = locks.entries_.begin() + static_cast<std::ptrdiff_t>(locks.size_);
+        std::sort(locks.entries_.begin(), end, [](const auto& lhs, const auto& rhs) {
+            return std::less<>{}(lhs.lock_, rhs.lock_);
+        });
+        end = std::unique(locks.entries_.begin(), end,
+                          [](const auto& lhs, const auto& rhs) { return lhs.lock_ == rhs.lock_; });
+        locks.size_ = static_cast<std::size_t>(end - locks.entries_.begin());
+        return locks;
+    }
+
+    static void lock_all(const lock_set& locks)
+    {
+        for (std::size_t i = 0; i < locks.size_; ++i)
+        {
+            locks.entries_[i].acquire_(locks.entries_[i].lock_);
+        }
+    }
+
+    static void unlock_all(const lock_set& locks)
+    {
+        for (std::size_t i = locks.size_; i > 0; --i)
+        {
+            locks.entries_[i - 1].release_(locks.entries_[i - 1].lock_);
+        }
+    }
+
+    static auto random() -> std::uint32_t
+    {
+        // xorshift32, only used to pick the polling order
+        thread_local std::uint32_t state = 0x9e3779b9U;
+        state ^= state << 13U;
+        state ^= state >> 17U;
+        state ^= state << 5U;
+        return state;
+    }
+
+    static auto shuffled() -> std::array<std::size_t, sizeof...(Cases)>
+    {
+        std::array<std::size_t, sizeof...(Cases)> order{};
+        std::iota(order.begin(), order.end(), std::size_t{0});
+        for (std::size_t i = order.size(); i > 1; --i)
+        {
+            const auto pick = static_cast<std::size_t>((std::uint64_t{random()} * i) >> 32U);
+            std::swap(order[i - 1], order[pick]);
+        }
+        return order;
+    }
+
+    std::tuple<Cases&...> cases_;
+    select_state state_{};
+    std::size_t winner_ = select_state::none;
+    bool parked_ = false;
+};
+
+template <typename... Cases>
+auto select(Cases&... cases) -> select_awaiter<Cases...>
+{
+    return select_awaiter<Cases...>{cases...};
+}
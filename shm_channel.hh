@@ -0,0 +1,389 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <bit>
+#include <cerrno>
+#include <climits>
+#include <coroutine>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <new>
+#include <optional>
+#include <stdexcept>
+#include <system_error>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+
+#include <linux/futex.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "executor.hh"
+#include "ring_buffer.hh"
+
+// Channel between two processes, one sending and one receiving, over a ring
+// in a memfd region. The creating process passes fd() to its peer, by fork or
+// over a unix socket, which attaches with shm_channel::attach(fd). Both sides only
+// touch the shared indexes while the ring is neither full nor empty: no lock,
+// no syscall. A side finding it full or empty raises its parked word, checks
+// again, and sleeps on it with a futex; the other side only makes a syscall
+// when it sees that word raised.
+//
+// A parked coroutine is suspended like on any channel: its word is watched by
+// the futex_waiter of the executor driving it, or by run_ready() on a thread
+// no executor drives, which schedules it once the peer woke the word. Type
+// must be trivially copyable, values are copied into the shared ring as bytes.
+template <typename Type>
+class shm_channel
+{
+    static_assert(std::is_trivially_copyable_v<Type>, "values cross processes as raw bytes");
+    static_assert(std::atomic<std::uint64_t>::is_always_lock_free &&
+                      std::atomic<std::uint32_t>::is_always_lock_free &&
+                      sizeof(std::atomic<std::uint32_t>) == sizeof(std::uint32_t),
+                  "the shared words must be plain lock-free integers");
+
+    // Coroutine parked on one side of the channel, recv or send
+    struct waiter : futex_waiter::entry
+    {
+        shm_channel& channel_;
+        bool receiving_;
+    };
+
+public:
+    // Create a region buffering buffer_size values, at least one
+    explicit shm_channel(std::size_t buffer_size) : fd_{::memfd_create("shm_channel", MFD_CLOEXEC)}
+    {
+        if (fd_ < 0)
+        {
+            throw std::system_error(errno, std::generic_category(), "memfd_create");
+        }
+        const std::size_t capacity = std::bit_ceil(std::max<std::size_t>(buffer_size, 1));
+        if (::ftruncate(fd_, static_cast<off_t>(region_size(capacity))) < 0)
+        {
+            const int error = errno;
+            ::close(fd_);
+            throw std::system_error(error, std::generic_category(), "ftruncate shm_channel");
+        }
+        map(capacity);
+        new (shared_) shared{};
+        shared_->capacity_ = capacity;
+    }
+
+    // Attach to the region of fd, which is duplicated
+    static auto attach(int fd) -> shm_channel
+    {
+        return shm_channel{attach_tag{}, fd};
+    }
+
+    shm_channel(const shm_channel&) = delete;
+    auto operator=(const shm_channel&) -> shm_channel& = delete;
+
+    // No coroutine of this process may still be parked on the channel
+    ~shm_channel()
+    {
+        ::munmap(shared_, region_size(capacity_));
+        ::close(fd_);
+    }
+
+    // Region to hand to the peer process
+    [[nodiscard]] auto fd() const -> int
+    {
+        return fd_;
+    }
+
+    struct async_recv : public waiter
+    {
+        [[nodiscard]] auto await_ready() -> bool
+        {
+            return this->channel_.pop(data_) || this->channel_.closed();
+        }
+        auto await_suspend(std::coroutine_handle<> handle) -> std::coroutine_handle<>
+        {
+            return this->channel_.park(*this, handle);
+        }
+        auto await_resume()
+        {
+            if (!data_)
+            {
+                this->channel_.pop(data_);
+            }
+            return data_ ? std::make_tuple(*data_, true) : std::make_tuple(Type{}, false);
+        }
+
+        std::optional<Type> data_{};
+    };
+    auto recv() -> async_recv
+    {
+        return async_recv{{{}, *this, true}};
+    }
+
+    // Receive like recv() but resume with the value, or with nothing once the
+    // channel is closed and drained
+    struct async_recv_optional : public async_recv
+    {
+        auto await_resume() -> std::optional<Type>
+        {
+            if (!this->data_)
+            {
+                this->channel_.pop(this->data_);
+            }
+            return this->data_;
+        }
+    };
+    auto recv_optional() -> async_recv_optional
+    {
+        return async_recv_optional{{{{}, *this, true}}};
+    }
+
+    // Resumes with true once the value is in the ring, false when the channel
+    // was closed first
+    struct async_send : public waiter
+    {
+        [[nodiscard]] auto await_ready() -> bool
+        {
+            if (this->channel_.closed())
+            {
+                return true;
+            }
+            sent_ = this->channel_.push(data_);
+            return sent_;
+        }
+        auto await_suspend(std::coroutine_handle<> handle) -> std::coroutine_handle<>
+        {
+            return this->channel_.park(*this, handle);
+        }
+        auto await_resume() -> bool
+        {
+            if (!sent_ && !this->channel_.closed())
+            {
+                sent_ = this->channel_.push(data_);
+            }
+            return sent_;
+        }
+
+        Type data_;
+        bool sent_ = false;
+    };
+    auto send(const Type& value) -> async_send
+    {
+        return async_send{{{}, *this, false}, value};
+    }
+
+    // Send without waiting. False when the ring is full or the channel closed.
+    auto try_send(const Type& value) -> bool
+    {
+        return !closed() && push(value);
+    }
+
+    // Wake both sides, in either process. Values already in the ring can still
+    // be received.
+    void close()
+    {
+        shared_->closed_.store(1);
+        wake(shared_->recv_parked_);
+        wake(shared_->send_parked_);
+    }
+
+    [[nodiscard]] auto closed() const -> bool
+    {
+        return shared_->closed_.load() != 0;
+    }
+
+private:
+    struct attach_tag
+    {};
+
+    shm_channel(attach_tag, int fd) : fd_{::dup(fd)}
+    {
+        if (fd_ < 0)
+        {
+            throw std::system_error(errno, std::generic_category(), "dup shm_channel");
+        }
+        struct stat info{};
+        if (::fstat(fd_, &info) < 0 || static_cast<std::size_t>(info.st_size) < sizeof(shared))
+        {
+            ::close(fd_);
+            throw std::invalid_argument("not a shm_channel region");
+        }
+        // Read the capacity chosen by the creator first
+        void* header = ::mmap(nullptr, sizeof(shared), PROT_READ, MAP_SHARED, fd_, 0);
+        if (header == MAP_FAILED)
+        {
+            const int error = errno;
+            ::close(fd_);
+            throw std::system_error(error, std::generic_category(), "mmap shm_channel");
+        }
+        const std::size_t capacity = static_cast<shared*>(header)->capacity_;
+        ::munmap(header, sizeof(shared));
+        if (!std::has_single_bit(capacity) ||
+            static_cast<std::size_t>(info.st_size) < region_size(capacity))
+        {
+            ::close(fd_);
+            throw std::invalid_argument("not a shm_channel region");
+        }
+        map(capacity);
+    }
+
+    // Start of the region, each index on its own cache line and the values
+    // right after
+    struct shared
+    {
+        alignas(cache_line_size) std::atomic<std::uint64_t> head_{0};
+        alignas(cache_line_size) std::atomic<std::uint64_t> tail_{0};
+        // Raised by a side about to sleep in a futex on it
+        alignas(cache_line_size) std::atomic<std::uint32_t> recv_parked_{0};
+        std::atomic<std::uint32_t> send_parked_{0};
+        std::atomic<std::uint32_t> closed_{0};
+        std::uint64_t capacity_ = 0;
+    };
+
+    static constexpr std::size_t slots_offset =
+        (sizeof(shared) + alignof(Type) - 1) / alignof(Type) * alignof(Type);
+
+    static auto region_size(std::size_t capacity) -> std::size_t
+    {
+        return slots_offset + capacity * sizeof(Type);
+    }
+
+    void map(std::size_t capacity)
+    {
+        void* region =
+            ::mmap(nullptr, region_size(capacity), PROT_READ | PROT_WRITE, MAP_SHARED, fd_, 0);
+        if (region == MAP_FAILED)
+        {
+            const int error = errno;
+            ::close(fd_);
+            throw std::system_error(error, std::generic_category(), "mmap shm_channel");
+        }
+        shared_ = static_cast<shared*>(region);
+        slots_ = static_cast<std::byte*>(region) + slots_offset;
+        capacity_ = capacity;
+    }
+
+    auto slot(std::uint64_t index) -> std::byte*
+    {
+        return slots_ + (index & (capacity_ - 1)) * sizeof(Type);
+    }
+
+    // Receiving side. Moving head before reading send_parked_ pairs with the
+    // sender raising it before reading head again, one of them sees the other.
+    auto pop(std::optional<Type>& out) -> bool
+    {
+        const auto head = shared_->head_.load(std::memory_order_relaxed);
+        if (head == tail_cache_)
+        {
+            tail_cache_ = shared_->tail_.load(std::memory_order_acquire);
+            if (head == tail_cache_)
+            {
+                return false;
+            }
+        }
+        std::array<std::byte, sizeof(Type)> bytes;
+        std::memcpy(bytes.data(), slot(head), sizeof(Type));
+        out.emplace(std::bit_cast<Type>(bytes));
+        shared_->head_.store(head + 1);
+        if (shared_->send_parked_.load() != 0)
+        {
+            wake(shared_->send_parked_);
+        }
+        return true;
+    }
+
+    // Sending side, the mirror of pop()
+    auto push(const Type& value) -> bool
+    {
+        const auto tail = shared_->tail_.load(std::memory_order_relaxed);
+        if (tail - head_cache_ == capacity_)
+        {
+            head_cache_ = shared_->head_.load(std::memory_order_acquire);
+            if (tail - head_cache_ == capacity_)
+            {
+                return false;
+            }
+        }
+        std::memcpy(slot(tail), &value, sizeof(Type));
+        shared_->tail_.store(tail + 1);
+        if (shared_->recv_parked_.load() != 0)
+        {
+            wake(shared_->recv_parked_);
+        }
+        return true;
+    }
+
+    auto word(const waiter& side) -> std::atomic<std::uint32_t>&
+    {
+        return side.receiving_ ? shared_->recv_parked_ : shared_->send_parked_;
+    }
+
+    auto blocked(const waiter& side) -> bool
+    {
+        if (closed())
+        {
+            return false;
+        }
+        const auto head = shared_->head_.load();
+        const auto tail = shared_->tail_.load();
+        return side.receiving_ ? head == tail : tail - head == capacity_;
+    }
+
+    // Raise the word before checking again, so a peer moving its index
+    // afterwards sees it and wakes the futex. The coroutine may be resumed as
+    // soon as it was handed to wait_futex().
+    auto park(waiter& side, std::coroutine_handle<> handle) -> std::coroutine_handle<>
+    {
+        if (!raise(side))
+        {
+            return handle;
+        }
+        side.word_ = &word(side);
+        side.parked_ = 1;
+        side.ready_ = &ready;
+        side.handle_ = handle;
+        wait_futex(side);
+        return next_ready();
+    }
+
+    // False, with the word lowered again, when the side is not blocked
+    auto raise(waiter& side) -> bool
+    {
+        auto& parked = word(side);
+        parked.store(1);
+        if (!blocked(side))
+        {
+            parked.store(0);
+            return false;
+        }
+        return true;
+    }
+
+    // The word was lowered, by a peer that may have moved for an earlier park
+    // of this side: park again while still blocked
+    static auto ready(futex_waiter::entry& wait) -> bool
+    {
+        auto& side = static_cast<waiter&>(wait);
+        return !side.channel_.raise(side);
+    }
+
+    static void wake(std::atomic<std::uint32_t>& parked)
+    {
+        if (parked.exchange(0) != 0)
+        {
+            ::syscall(SYS_futex, reinterpret_cast<std::uint32_t*>(&parked), FUTEX_WAKE, INT_MAX,
+                      nullptr, nullptr, 0);
+        }
+    }
+
+    int fd_;
+    shared* shared_ = nullptr;
+    std::byte* slots_ = nullptr;
+    std::size_t capacity_ = 0;
+    // Indexes of the peer as last read by this endpoint
+    std::uint64_t head_cache_ = 0;
+    std::uint64_t tail_cache_ = 0;
+};
@@ -0,0 +1,115 @@
+#pragma once
+
+#include <coroutine>
+#include <cstddef>
+#include <tuple>
+#include <utility>
+
+#include "ring_buffer.hh"
+
+// First channel of the project: awaiters only record their handle, the caller
+// decides when to resume them. Lives in its own namespace so that benchmarks can
+// use it next to channel.hh.
+namespace simple
+{
+template <typename Type>
+class channel
+{
+public:
+    // send() queues its value before the awaiter checks for room, hence the extra slot
+    channel(std::size_t buffer_size = 0) : buffer_size_{buffer_size}, fifo_{buffer_size + 1}
+    {}
+    struct async_recv
+    {
+        channel<Type>& channel_;
+        [[nodiscard]] auto await_ready() const -> bool
+        {
+            return !channel_.fifo_.empty();
+        }
+        void await_suspend(std::coroutine_handle<> handle)
+        {
+            handle_ = handle;
+        }
+        auto await_resume()
+        {
+            if (channel_.closed_ && channel_.fifo_.empty())
+            {
+                return std::make_tuple(Type{}, false);
+            }
+            --channel_.receivers_;
+            Type data = std::move(channel_.fifo_.front());
+            channel_.fifo_.pop_front();
+            return std::make_tuple(std::move(data), true);
+        }
+        std::coroutine_handle<> handle_{};
+    };
+    auto recv() -> async_recv
+    {
+        ++receivers_;
+        return async_recv{*this};
+    }
+
+    struct async_send
+    {
+        channel<Type>& channel_;
+        [[nodiscard]] auto await_ready() const -> bool
+        {
+            return channel_.fifo_.size() < channel_.buffer_size_ + channel_.receivers_;
+        }
+        void await_suspend(std::coroutine_handle<> handle)
+        {
+            handle_ = handle;
+        }
+        void await_resume()
+        {}
+        std::coroutine_handle<> handle_{};
+    };
+
+    auto send(const Type& type) -> async_send
+    {
+        fifo_.push_back(type);
+        return async_send{*this};
+    }
+
+    auto send(Type&& type) -> async_send
+    {
+        fifo_.push_back(std::move(type));
+        return async_send{*this};
+    }
+
+    void close()
+    {
+        closed_ = true;
+    }
+
+private:
+    std::size_t buffer_size_;
+    std::size_t receivers_{0};
+    ring_buffer<Type> fifo_;
+    bool closed_{false};
+};
+
+struct continuable
+{
+    struct promise_type
+    {
+        auto get_return_object() -> continuable
+        {
+            return {std::coroutine_handle<promise_type>::from_promise(*this)};
+        }
+        auto initial_suspend() -> std::suspend_never
+        {
+            return {};
+        }
+        auto final_suspend() noexcept -> std::suspend_never
+        {
+            return {};
+        }
+        void return_void()
+        {}
+        void unhandled_exception()
+        {}
+    };
+    std::coroutine_handle<promise_type> handle_;
+};
+} // namespace simple
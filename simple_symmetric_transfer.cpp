@@ -1,222 +1,49 @@
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
 #include <cassert>
+#include <cerrno>
 #include <coroutine>
 #include <cstddef>
-#include <deque>
+#include <cstdlib>
+#include <filesystem>
 #include <iostream>
 #include <iterator>
-#include <list>
 #include <memory>
+#include <numeric>
 #include <source_location>
+#include <span>
 #include <stdexcept>
+#include <stop_token>
+#include <string>
 #include <string_view>
+#include <system_error>
+#include <thread>
 #include <tuple>
 #include <utility>
+#include <variant>
+#include <vector>
 
-#include "lazy.hh"
-
-template <typename Derived>
-class IntrusiveNode
-{
-public:
-    Derived* next = nullptr;
-};
-
-template <typename T>
-class FIFOList
-{
-public:
-    FIFOList() : head(nullptr), tail(nullptr)
-    {}
-
-    void push(T* newNode)
-    {
-        if (tail == nullptr)
-        {
-            head = newNode;
-            tail = newNode;
-        }
-        else
-        {
-            tail->next = newNode;
-            tail = newNode;
-        }
-    }
-
-    auto pop() -> T*
-    {
-        if (head == nullptr)
-        {
-            return nullptr;
-        }
-
-        T* elem = head;
-        head = head->next;
-        if (head == nullptr)
-        {
-            // The list becomes empty after the pop
-            tail = nullptr;
-        }
-
-        return elem;
-    }
-
-    [[nodiscard]] auto empty() const -> bool
-    {
-        return head == nullptr;
-    }
-
-private:
-    T* head;
-    T* tail;
-};
-
-template <typename Type>
-class channel
-{
-public:
-    channel(std::size_t buffer_size = 0) : buffer_size_{buffer_size}
-    {}
-    struct async_recv : public IntrusiveNode<async_recv>
-    {
-        async_recv(channel<Type>& channel) : channel_{channel}
-        {}
-
-        [[nodiscard]] auto await_ready() const -> bool
-        {
-            return !channel_.fifo_.empty() || !channel_.senders_.empty();
-        }
-        auto await_suspend(std::coroutine_handle<> handle) -> std::coroutine_handle<>
-        {
-            handle_ = handle;
-            channel_.receivers_.push(this);
-            if (!channel_.consumeds_.empty())
-            {
-                auto send = channel_.consumeds_.pop();
-                return send->handle_;
-            }
-            return std::noop_coroutine();
-        }
-        auto await_resume()
-        {
-            if (!channel_.fifo_.empty())
-            {
-                Type data = std::move(channel_.fifo_.front());
-                channel_.fifo_.pop_front();
-                return std::make_tuple(std::move(data), true);
-            }
-            if (!channel_.senders_.empty())
-            {
-                auto send = channel_.senders_.pop();
-                Type data = std::move(send->data_.value());
-                send->data_.reset();
-                channel_.consumeds_.push(send);
-                return std::make_tuple(std::move(data), true);
-            }
-            if (!channel_.closed_)
-            {
-                throw std::runtime_error("unexpected await resume");
-            }
-            return std::make_tuple(Type{}, false);
-        }
-
-        channel<Type>& channel_;
-        std::coroutine_handle<> handle_{};
-    };
-    auto recv() -> async_recv
-    {
-        return async_recv{*this};
-    }
-
-    struct async_send : public IntrusiveNode<async_send>
-    {
-        async_send(channel<Type>& channel, Type&& data) : channel_{channel}, data_{std::move(data)}
-        {}
-
-        auto await_ready() -> bool
-        {
-            if (channel_.full())
-            {
-                return false;
-            }
-            channel_.fifo_.push_back(std::move(data_.value()));
-            data_.reset();
-            return true;
-        }
-        auto await_suspend(std::coroutine_handle<> handle) -> std::coroutine_handle<>
-        {
-            handle_ = handle;
-            channel_.senders_.push(this);
-            if (!channel_.receivers_.empty())
-            {
-                auto recv = channel_.receivers_.pop();
-                return recv->handle_;
-            }
-            return std::noop_coroutine();
-        }
-        void await_resume()
-        {}
-        channel<Type>& channel_;
-        std::optional<Type> data_;
-        std::coroutine_handle<> handle_{};
-    };
-
-    auto send(const Type& type) -> async_send
-    {
-        return async_send{*this, Type{type}};
-    }
-
-    auto send(Type&& type) -> async_send
-    {
-        return async_send{*this, std::move(type)};
-    }
-
-    void close()
-    {
-        closed_ = true;
-    }
-
-    [[nodiscard]] auto closed() const -> bool
-    {
-        return closed_;
-    }
+#include <fcntl.h>
+#include <sys/wait.h>
+#include <unistd.h>
 
-    [[nodiscard]] auto empty() const -> bool
-    {
-        return closed_ && receivers_.empty() && senders_.empty() && consumeds_.empty();
-    }
-
-    void sync_await()
-    {
-        while ((closed_ || !fifo_.empty()) && !receivers_.empty())
-        {
-            auto recv = receivers_.pop();
-            recv->handle_.resume();
-        }
-        while (!consumeds_.empty())
-        {
-            auto send = consumeds_.pop();
-            send->handle_.resume();
-        }
-        while ((closed_ || !full()) && !senders_.empty())
-        {
-            auto send = senders_.pop();
-            send->handle_.resume();
-        }
-    }
-
-private:
-    auto full() -> bool
-    {
-        return fifo_.size() >= buffer_size_;
-    }
-
-    std::size_t buffer_size_;
-    FIFOList<async_recv> receivers_{};
-    FIFOList<async_send> senders_{};
-    FIFOList<async_send> consumeds_{};
-    std::deque<Type> fifo_{};
-    bool closed_{false};
-};
+#include "async_generator.hh"
+#include "broadcast.hh"
+#include "channel.hh"
+#include "executor.hh"
+#include "frame_pool.hh"
+#include "io_polling.hh"
+#include "lazy.hh"
+#include "pipeline.hh"
+#include "priority_channel.hh"
+#include "select.hh"
+#include "shm_channel.hh"
+#include "slab_pool.hh"
+#include "spill_buffer.hh"
+#include "ticker.hh"
+#include "when_all.hh"
 
 auto recv1(std::shared_ptr<channel<int>> chan) -> std::lazy<void>
 {
@@ -270,6 +97,12 @@ auto send(std::shared_ptr<channel<int>> chan) -> std::lazy<void>
     co_await chan->send(3);
     std::cout << "send: close\n";
     chan->close();
+    // A closed channel takes no more values
+    const bool sent = co_await chan->send(4);
+    if (!sent)
+    {
+        std::cout << "send: 4 dropped\n";
+    }
     std::cout << "send: end\n";
     co_return;
 };
@@ -287,7 +120,7 @@ auto tick(std::shared_ptr<channel<int>> tick, std::shared_ptr<channel<int>> tack
         }
         std::cout << "tick: " << a << "\n";
         co_await tack->send(a);
-        // in this demo tack chan->sync_await() resume here
+        // resumed by symmetric transfer once tack took the value
     }
 }
 
@@ -306,7 +139,7 @@ auto tack(std::shared_ptr<channel<int>> tick, std::shared_ptr<channel<int>> tack
         if (a < 10)
         {
             co_await tick->send(a);
-            // in this demo tick chan->sync_await() resume here
+            // resumed by symmetric transfer once tick took the value
         }
         else
         {
@@ -326,15 +159,8 @@ void ticktack()
     lazy_tick.sync_await();
     std::cout << "sync_await lazy_tack\n";
     lazy_tack.sync_await();
-    std::list<decltype(chan_tick)> chans{};
-    chans.push_back(chan_tick);
-    chans.push_back(chan_tack);
-    while (!chans.empty())
-    {
-        std::cout << " sync_await chans (" << chans.size() << ")\n";
-        for (const auto& chan : chans) { chan->sync_await(); }
-        chans.remove_if([](const auto& chan) { return chan->empty(); });
-    }
+    // Closing tick woke the parked tick loop, it only has to run
+    run_ready();
     std::cout << "end ticktack\n";
 }
 
@@ -355,9 +181,910 @@ void single_chan()
     std::cout << "auto coro handle destroy with lazy promise_type\n";
 }
 
+auto count(std::shared_ptr<channel<int>> chan, int first, int step) -> std::lazy<void>
+{
+    for (int i = first; i < 6; i += step)
+    {
+        co_await chan->send(i);
+    }
+    chan->close();
+}
+
+auto merge(std::shared_ptr<channel<int>> evens, std::shared_ptr<channel<int>> odds)
+    -> std::lazy<void>
+{
+    auto poll = evens->recv();
+    if (co_await select(poll, select_default) == 1)
+    {
+        std::cout << "merge: nothing ready\n";
+    }
+    bool evens_open = true;
+    bool odds_open = true;
+    while (evens_open && odds_open)
+    {
+        auto recv_evens = evens->recv();
+        auto recv_odds = odds->recv();
+        if (co_await select(recv_evens, recv_odds) == 0)
+        {
+            auto&& [a, ok] = recv_evens.await_resume();
+            evens_open = ok;
+            std::cout << "merge evens: " << (ok ? std::to_string(a) : "closed") << "\n";
+        }
+        else
+        {
+            auto&& [a, ok] = recv_odds.await_resume();
+            odds_open = ok;
+            std::cout << "merge odds: " << (ok ? std::to_string(a) : "closed") << "\n";
+        }
+    }
+    auto& rest = evens_open ? evens : odds;
+    while (true)
+    {
+        auto&& [a, ok] = co_await rest->recv();
+        if (!ok)
+        {
+            break;
+        }
+        std::cout << "merge rest: " << a << "\n";
+    }
+    std::cout << "merge: end\n";
+}
+
+void select_chans()
+{
+    auto evens = std::make_shared<channel<int>>();
+    auto odds = std::make_shared<channel<int>>();
+    auto lazy_merge = merge(evens, odds);
+    auto lazy_evens = count(evens, 0, 2);
+    auto lazy_odds = count(odds, 1, 2);
+    lazy_merge.sync_await();
+    lazy_evens.sync_await();
+    lazy_odds.sync_await();
+    run_ready();
+}
+
+auto send_batches(std::shared_ptr<channel<int>> chan) -> std::lazy<void>
+{
+    std::array<int, 10> values{};
+    std::iota(values.begin(), values.end(), 0);
+    const auto sent = co_await chan->send_many(values);
+    std::cout << "send_many: " << sent << " values\n";
+    chan->close();
+}
+
+auto recv_batches(std::shared_ptr<channel<int>> chan) -> std::lazy<void>
+{
+    std::array<int, 3> values{};
+    while (const auto count = co_await chan->recv_many(values))
+    {
+        std::cout << "recv_many:";
+        for (const auto value : std::span{values}.first(count))
+        {
+            std::cout << " " << value;
+        }
+        std::cout << "\n";
+    }
+}
+
+void batch_chan()
+{
+    auto chan = std::make_shared<channel<int>>(4);
+    auto lazy_recv = recv_batches(chan);
+    auto lazy_send = send_batches(chan);
+    lazy_recv.sync_await();
+    lazy_send.sync_await();
+    run_ready();
+}
+
+auto produce(std::shared_ptr<channel<int, mpmc>> chan, int first, int count) -> std::lazy<void>
+{
+    for (int i = first; i < first + count; ++i)
+    {
+        co_await chan->send(i);
+    }
+}
+
+auto consume(std::shared_ptr<channel<int, mpmc>> chan, int count, long& sum) -> std::lazy<void>
+{
+    for (int i = 0; i < count; ++i)
+    {
+        auto&& [a, ok] = co_await chan->recv();
+        if (!ok)
+        {
+            break;
+        }
+        sum += a;
+    }
+    chan->close();
+}
+
+void fan_in()
+{
+    constexpr int producers = 4;
+    constexpr int per_producer = 1000;
+    auto chan = std::make_shared<channel<int, mpmc>>(16);
+    long sum = 0;
+    {
+        // Parked coroutines are pushed onto the executor by the channel, no
+        // polling loop is needed to drive them
+        executor exec{producers};
+        exec.spawn(consume(chan, producers * per_producer, sum));
+        for (int i = 0; i < producers; ++i)
+        {
+            exec.spawn(produce(chan, i * per_producer, per_producer));
+        }
+        exec.wait();
+    }
+    constexpr long total = producers * per_producer;
+    std::cout << "fan_in sum: " << sum << " (expected " << total * (total - 1) / 2 << ")\n";
+}
+
+auto square(int value) -> pooled_lazy<int>
+{
+    co_return value * value;
+}
+
+auto accumulate(int value, std::atomic<long>& sum) -> pooled_lazy<void>
+{
+    sum += co_await square(value);
+}
+
+// Keeps its worker busy until released, once it allocated a frame
+auto hold_worker(std::atomic<int>& held, const std::atomic<bool>& released) -> pooled_lazy<void>
+{
+    co_await square(0);
+    held.fetch_add(1);
+    while (!released.load())
+    {
+        std::this_thread::yield();
+    }
+}
+
+void pooled_tasks()
+{
+    constexpr int workers = 2;
+    constexpr int tasks = 1000;
+    constexpr int rounds = 3;
+    std::atomic<long> sum = 0;
+    executor exec{workers};
+    // The first round runs once it is fully spawned and every worker holds a
+    // frame: a worker that stole nothing would carve its pool's first chunk
+    // in a later round, and so would this thread's pool if workers released
+    // fewer frames while it spawns a later round
+    std::atomic<int> held = 0;
+    std::atomic<bool> released = false;
+    for (int i = 0; i < workers; ++i)
+    {
+        exec.spawn(hold_worker(held, released));
+    }
+    while (held.load() < workers)
+    {
+        std::this_thread::yield();
+    }
+    std::size_t steady_heap_allocations = 0;
+    for (int round = 0; round < rounds; ++round)
+    {
+        const auto before = frame_pool::stats();
+        for (int i = 0; i < tasks; ++i)
+        {
+            exec.spawn(accumulate(i, sum));
+        }
+        released.store(true);
+        exec.wait();
+        const auto after = frame_pool::stats();
+        const auto heap_allocations = after.heap_allocations - before.heap_allocations;
+        // Once the pools are warm a round reuses the frames of the previous one
+        std::cout << "pooled round " << round << ": "
+                  << after.allocations - before.allocations << " frames, " << heap_allocations
+                  << " heap allocations\n";
+        if (round > 0)
+        {
+            steady_heap_allocations += heap_allocations;
+        }
+    }
+    std::cout << "pooled sum: " << sum << " (expected "
+              << static_cast<long>(rounds) * (tasks - 1) * tasks * (2 * tasks - 1) / 6 << ")\n";
+    if (steady_heap_allocations != 0)
+    {
+        throw std::logic_error("frame_pool allocated from the heap once warm");
+    }
+}
+
+// Sized at compile time, its buffer is part of the frame holding it
+using reply_channel = static_channel<int, 4>;
+
+auto reply_parts(reply_channel& replies, int request) -> pooled_lazy<void>
+{
+    for (int part = 0; part < 4; ++part)
+    {
+        co_await replies.send(request + part);
+    }
+}
+
+auto handle_request(channel<int>& start, int request, std::atomic<long>& sum)
+    -> pooled_lazy<void>
+{
+    co_await start.recv();
+    reply_channel replies{};
+    co_await reply_parts(replies, request);
+    for (int part = 0; part < 4; ++part)
+    {
+        auto [value, ok] = co_await replies.recv();
+        sum += value;
+    }
+}
+
+auto open_requests(channel<int>& start) -> pooled_lazy<void>
+{
+    start.close();
+    co_return;
+}
+
+void request_channels()
+{
+    constexpr int requests = 1000;
+    constexpr int rounds = 4;
+    std::atomic<long> sum = 0;
+    // Frames are allocated here and released by the worker, the single one so
+    // that its own pool is warm after the first round too
+    executor exec{1};
+    std::size_t steady_heap_allocations = 0;
+    for (int round = 0; round < rounds; ++round)
+    {
+        // Every request of a round is parked on start before the worker opens
+        // it, the first round sizes the pools for all of them at once
+        channel<int> start{};
+        const auto before = frame_pool::stats();
+        for (int i = 0; i < requests; ++i)
+        {
+            exec.spawn(handle_request(start, i, sum));
+        }
+        exec.spawn(open_requests(start));
+        exec.wait();
+        const auto after = frame_pool::stats();
+        const auto heap_allocations = after.heap_allocations - before.heap_allocations;
+        std::cout << "request round " << round << ": "
+                  << after.allocations - before.allocations << " frames, "
+                  << after.remote_frees - before.remote_frees << " returned across threads, "
+                  << heap_allocations << " heap allocations\n";
+        if (round > 0)
+        {
+            steady_heap_allocations += heap_allocations;
+        }
+    }
+    std::cout << "request sum: " << sum << " (expected "
+              << static_cast<long>(rounds) * (requests * 4L * (requests - 1) / 2 + requests * 6L)
+              << ")\n";
+    if (steady_heap_allocations != 0)
+    {
+        throw std::logic_error("frame_pool allocated from the heap once warm");
+    }
+}
+
+auto fill_slabs(slab_pool& pool, std::shared_ptr<slab_channel<mpmc>> chan, int count)
+    -> std::lazy<void>
+{
+    for (int i = 0; i < count; ++i)
+    {
+        // The channel bounds the slabs in flight below the pool size
+        auto buffer = pool.try_acquire();
+        auto bytes = buffer.data();
+        std::fill(bytes.begin(), bytes.end(), std::byte{static_cast<unsigned char>(i)});
+        buffer.resize(bytes.size());
+        co_await chan->send(std::move(buffer));
+    }
+}
+
+auto drain_slabs(std::shared_ptr<slab_channel<mpmc>> chan, int count, long& sum)
+    -> std::lazy<void>
+{
+    for (int i = 0; i < count; ++i)
+    {
+        auto&& [buffer, ok] = co_await chan->recv();
+        // Only the handle moved, the payload is read where the producer wrote it
+        sum += std::to_integer<long>(buffer.view().back());
+    }
+}
+
+void slab_buffers()
+{
+    constexpr int buffers = 1000;
+    slab_pool pool{16 * 1024, 16};
+    auto chan = std::make_shared<slab_channel<mpmc>>(8);
+    long sum = 0;
+    {
+        executor exec{2};
+        exec.spawn(drain_slabs(chan, buffers, sum));
+        exec.spawn(fill_slabs(pool, chan, buffers));
+        exec.wait();
+    }
+    std::cout << "slab sum: " << sum << ", " << pool.available() << " slabs back in the pool\n";
+}
+
+// Counts how often messages are copied or moved on their way, it has no
+// default constructor so it can only be received with recv_optional()
+class tracked
+{
+public:
+    explicit tracked(int value) : value_{value}
+    {}
+    tracked(const tracked& other) : value_{other.value_}
+    {
+        ++copies;
+    }
+    tracked(tracked&& other) noexcept : value_{other.value_}
+    {
+        ++moves;
+    }
+    auto operator=(const tracked& other) -> tracked& = delete;
+    auto operator=(tracked&& other) noexcept -> tracked&
+    {
+        value_ = other.value_;
+        ++moves;
+        return *this;
+    }
+
+    [[nodiscard]] auto value() const -> int
+    {
+        return value_;
+    }
+
+    static inline long copies = 0;
+    static inline long moves = 0;
+
+private:
+    int value_;
+};
+
+auto send_tracked(std::shared_ptr<channel<tracked>> chan, int count, bool emplace)
+    -> std::lazy<void>
+{
+    for (int i = 0; i < count; ++i)
+    {
+        if (emplace)
+        {
+            co_await chan->emplace_send(i);
+        }
+        else
+        {
+            const tracked message{i};
+            co_await chan->send(message);
+        }
+    }
+    chan->close();
+}
+
+auto recv_tracked(std::shared_ptr<channel<tracked>> chan, long& sum) -> std::lazy<void>
+{
+    while (auto message = co_await chan->recv_optional())
+    {
+        sum += message->value();
+    }
+}
+
+void in_place()
+{
+    constexpr int count = 1000;
+    for (const bool emplace : {false, true})
+    {
+        auto chan = std::make_shared<channel<tracked>>(4);
+        long sum = 0;
+        tracked::copies = 0;
+        tracked::moves = 0;
+        auto lazy_recv = recv_tracked(chan, sum);
+        auto lazy_send = send_tracked(chan, count, emplace);
+        // The receiver parks first, every message is handed over directly
+        lazy_recv.sync_await();
+        lazy_send.sync_await();
+        run_ready();
+        std::cout << (emplace ? "emplace_send" : "send") << " sum " << sum << ": "
+                  << static_cast<double>(tracked::copies) / count << " copies, "
+                  << static_cast<double>(tracked::moves) / count << " moves per message\n";
+    }
+}
+
+// Segments go to /var/tmp, disk-backed where /tmp may be a tmpfs
+struct var_tmp_directory
+{
+    static auto path() -> std::filesystem::path
+    {
+        return "/var/tmp";
+    }
+};
+
+using spill_long_channel = spill_channel<long, 4096, single_thread, var_tmp_directory>;
+
+// Counts the values received out of order
+auto drain_spilled(std::shared_ptr<spill_long_channel> chan, long& received, long& misplaced)
+    -> std::lazy<void>
+{
+    while (auto value = co_await chan->recv_optional())
+    {
+        misplaced += *value != received;
+        ++received;
+    }
+}
+
+void spill_to_disk_buffer()
+{
+    constexpr long count = 1'000'000;
+    // All but 4KiB of the values go to disk, over two 4MiB segments
+    spill_ring_buffer<long, 4096, var_tmp_directory> buffer{count};
+    for (long i = 0; i < count; ++i)
+    {
+        buffer.push_back(i);
+    }
+    const auto spilled = buffer.spilled();
+    long next = 0;
+    for (; !buffer.empty() && buffer.front() == next; ++next)
+    {
+        buffer.pop_front();
+    }
+    std::cout << "spill buffer: " << spilled << " of " << count
+              << " values on disk, read back in order up to " << next << "\n";
+
+    // Nobody receives yet, the channel buffers them the same way
+    auto chan = std::make_shared<spill_long_channel>(count);
+    for (long i = 0; i < count; ++i)
+    {
+        chan->try_send(i);
+    }
+    chan->close();
+    long received = 0;
+    long misplaced = 0;
+    drain_spilled(chan, received, misplaced).sync_await();
+    std::cout << "spill channel: " << received << " values received, " << misplaced
+              << " out of order\n";
+    if (spilled + 4096 / sizeof(long) != count || next != count || received != count ||
+        misplaced != 0)
+    {
+        throw std::logic_error("spilled values did not come back in order");
+    }
+}
+
+auto generate_tracked(int count) -> async_generator<tracked>
+{
+    for (int i = 0; i < count; ++i)
+    {
+        tracked message{i};
+        co_yield message;
+    }
+}
+
+auto sum_generated(async_generator<tracked> gen, long& sum) -> std::lazy<void>
+{
+    while (auto* message = co_await gen.next())
+    {
+        sum += message->value();
+    }
+}
+
+void generators()
+{
+    constexpr int count = 1000;
+    long sum = 0;
+    tracked::copies = 0;
+    tracked::moves = 0;
+    sum_generated(generate_tracked(count), sum).sync_await();
+    std::cout << "async_generator sum " << sum << ": "
+              << static_cast<double>(tracked::copies) / count << " copies, "
+              << static_cast<double>(tracked::moves) / count << " moves per message\n";
+}
+
+auto send_range(std::shared_ptr<channel<int>> chan, int first, int last) -> std::lazy<void>
+{
+    for (int i = first; i < last; ++i)
+    {
+        co_await chan->send(i);
+    }
+    chan->close();
+}
+
+auto sum_batches(std::shared_ptr<channel<std::vector<long>>> chan,
+                 std::shared_ptr<channel<std::vector<long>>> spare, long& sum, int& batches)
+    -> std::lazy<void>
+{
+    while (auto values = co_await chan->recv_optional())
+    {
+        sum = std::accumulate(values->begin(), values->end(), sum);
+        ++batches;
+        // batch refills it instead of allocating the next one
+        values->clear();
+        spare->try_send(std::move(*values));
+    }
+}
+
+void stages()
+{
+    std::vector<std::shared_ptr<channel<int>>> sources{std::make_shared<channel<int>>(16),
+                                                       std::make_shared<channel<int>>(16)};
+    auto squares = std::make_shared<channel<long>>(16);
+    auto batches = std::make_shared<channel<std::vector<long>>>(4);
+    auto spare = std::make_shared<channel<std::vector<long>>>(4);
+    // filter and map run fused in the fan_in coroutines, one hop to squares
+    auto odd_squares = filter([](int value) { return value % 2 == 1; }) |
+                       map([](int value) { return static_cast<long>(value) * value; });
+    std::vector<std::lazy<void>> tasks = fan_in(sources, squares, odd_squares);
+    tasks.push_back(batch(squares, batches, 8, spare));
+    long sum = 0;
+    int count = 0;
+    tasks.push_back(sum_batches(batches, spare, sum, count));
+    tasks.push_back(send_range(sources[0], 0, 500));
+    tasks.push_back(send_range(sources[1], 500, 1000));
+    for (auto& task : tasks)
+    {
+        task.sync_await();
+    }
+    run_ready();
+    std::cout << "stages: odd squares sum " << sum << " in " << count << " batches\n";
+}
+
+auto publish_ticks(broadcast<int>& bus, int count) -> std::lazy<void>
+{
+    for (int i = 0; i < count; ++i)
+    {
+        co_await bus.send(i);
+    }
+    bus.close();
+}
+
+auto watch_ticks(broadcast<int>& bus, long& sum, std::size_t& missed) -> std::lazy<void>
+{
+    auto sub = bus.subscribe();
+    while (auto tick = co_await sub.recv())
+    {
+        sum += *tick;
+    }
+    missed = sub.missed();
+}
+
+void broadcasts()
+{
+    constexpr int watchers = 3;
+    for (const auto lag : {lag_policy::backpressure, lag_policy::drop_oldest})
+    {
+        broadcast<int> bus{4, lag};
+        std::array<long, watchers> sums{};
+        std::array<std::size_t, watchers> missed{};
+        std::vector<std::lazy<void>> tasks{};
+        for (int i = 0; i < watchers; ++i)
+        {
+            tasks.push_back(watch_ticks(bus, sums[i], missed[i]));
+            tasks.back().sync_await();
+        }
+        // With drop_oldest the publisher never waits and runs ahead of everyone
+        auto lazy_publish = publish_ticks(bus, 100);
+        lazy_publish.sync_await();
+        run_ready();
+        std::cout << (lag == lag_policy::backpressure ? "backpressure" : "drop_oldest") << ":";
+        for (int i = 0; i < watchers; ++i)
+        {
+            std::cout << (i == 0 ? " " : ", ") << "sum " << sums[i] << " missed " << missed[i];
+        }
+        std::cout << "\n";
+    }
+}
+
+using control_channel = priority_channel<int, 2>;
+
+auto send_bulk(control_channel& chan, int count) -> std::lazy<void>
+{
+    for (int i = 0; i < count; ++i)
+    {
+        co_await chan.send(i);
+    }
+    chan.close();
+}
+
+auto send_control(control_channel& chan, int count) -> std::lazy<void>
+{
+    for (int i = 0; i < count; ++i)
+    {
+        co_await chan.send(-1, chan.highest);
+    }
+}
+
+auto recv_mixed(control_channel& chan, std::vector<int>& bulk_before, int& bulk)
+    -> std::lazy<void>
+{
+    while (auto value = co_await chan.recv_optional())
+    {
+        if (*value < 0)
+        {
+            bulk_before.push_back(bulk);
+        }
+        else
+        {
+            ++bulk;
+        }
+    }
+}
+
+void priorities()
+{
+    control_channel chan{16};
+    std::vector<int> bulk_before{};
+    int bulk = 0;
+    // Both senders park on a full buffer before anything is received
+    auto lazy_bulk = send_bulk(chan, 1000);
+    auto lazy_control = send_control(chan, 3);
+    auto lazy_recv = recv_mixed(chan, bulk_before, bulk);
+    lazy_bulk.sync_await();
+    lazy_control.sync_await();
+    lazy_recv.sync_await();
+    run_ready();
+    std::cout << "control messages received after";
+    for (const auto bulk : bulk_before)
+    {
+        std::cout << " " << bulk;
+    }
+    std::cout << " of " << bulk << " bulk ones\n";
+}
+
+auto give_up(std::shared_ptr<channel<int>> chan) -> std::lazy<void>
+{
+    using namespace std::chrono_literals;
+    // Nobody sends nor receives on chan, both operations time out
+    if (auto got = co_await chan->recv_for(5ms); !got)
+    {
+        std::cout << "recv_for: timed out\n";
+    }
+    if (!co_await chan->send_for(1, 5ms))
+    {
+        std::cout << "send_for: timed out\n";
+    }
+}
+
+auto count_ticks() -> std::lazy<void>
+{
+    using namespace std::chrono_literals;
+    ticker ticks{2ms};
+    timer alarm{7ms};
+    for (int i = 0; i < 2; ++i)
+    {
+        co_await ticks.chan().recv();
+        std::cout << "tick " << i << "\n";
+    }
+    ticks.stop();
+    co_await alarm.chan().recv();
+    std::cout << "timer fired\n";
+}
+
+void deadlines()
+{
+    auto chan = std::make_shared<channel<int>>();
+    auto lazy_give_up = give_up(chan);
+    auto lazy_ticks = count_ticks();
+    lazy_give_up.sync_await();
+    lazy_ticks.sync_await();
+    // Sleeps until the armed timers fired
+    run_ready();
+}
+
+auto lookup(int id, std::chrono::milliseconds latency) -> std::lazy<int>
+{
+    timer reply{latency};
+    co_await reply.chan().recv();
+    co_return id * 10;
+}
+
+auto fan_out_lookups() -> std::lazy<void>
+{
+    using namespace std::chrono_literals;
+    const auto start = timer_wheel::clock::now();
+    auto [first, second, third] =
+        co_await when_all(lookup(1, 5ms), lookup(2, 10ms), lookup(3, 15ms));
+    const auto elapsed = timer_wheel::clock::now() - start;
+    std::cout << "when_all: " << first << " " << second << " " << third << ", "
+              << (elapsed < 30ms ? "concurrently" : "one after the other") << "\n";
+    // The slow lookup goes on in the background, run_ready() waits for it
+    auto fastest = co_await when_any(lookup(1, 20ms), lookup(2, 5ms));
+    std::cout << "when_any: lookup " << fastest.index() + 1 << " first with "
+              << std::visit([](int value) { return value; }, fastest) << "\n";
+}
+
+void sub_queries()
+{
+    auto lazy_lookups = fan_out_lookups();
+    lazy_lookups.sync_await();
+    run_ready();
+}
+
+auto recv_or_stop(std::shared_ptr<channel<int>> chan, std::stop_token token, int& served)
+    -> std::lazy<void>
+{
+    if (auto got = co_await chan->recv(std::move(token)); got)
+    {
+        ++served;
+    }
+}
+
+void shed_load()
+{
+    constexpr int waiters = 100;
+    auto chan = std::make_shared<channel<int>>();
+    std::stop_source stop{};
+    int served = 0;
+    std::vector<std::lazy<void>> tasks{};
+    for (int i = 0; i < waiters; ++i)
+    {
+        tasks.push_back(recv_or_stop(chan, stop.get_token(), served));
+        tasks.back().sync_await();
+    }
+    for (int i = 0; i < 3; ++i)
+    {
+        chan->try_send(i);
+    }
+    // The other receivers unlink themselves and finish, nothing stays parked
+    stop.request_stop();
+    run_ready();
+    std::cout << "shed_load: " << served << " served, " << waiters - served << " cancelled\n";
+}
+
+auto pipe_writer(io_polling& io, int fd, int first, int count) -> std::lazy<void>
+{
+    for (int i = first; i < first + count; ++i)
+    {
+        // Pipe writes up to PIPE_BUF are atomic, no partial int to resume
+        if (co_await io.write(fd, std::as_bytes(std::span{&i, 1})) < 0)
+        {
+            break;
+        }
+    }
+    io.forget(fd);
+    ::close(fd);
+}
+
+auto pipe_reader(io_polling& io, int fd, std::shared_ptr<channel<int>> out) -> std::lazy<void>
+{
+    int value = 0;
+    while (co_await io.read(fd, std::as_writable_bytes(std::span{&value, 1})) ==
+           static_cast<int>(sizeof(value)))
+    {
+        co_await out->send(value);
+    }
+    io.forget(fd);
+    ::close(fd);
+}
+
+auto sum_values(std::shared_ptr<channel<int>> chan, int count, long& sum) -> std::lazy<void>
+{
+    for (int i = 0; i < count; ++i)
+    {
+        auto&& [a, ok] = co_await chan->recv();
+        sum += a;
+    }
+}
+
+void pipes(io_backend backend)
+{
+    constexpr int pipes = 64;
+    constexpr int per_pipe = 1000;
+    io_polling io{backend};
+    auto chan = std::make_shared<channel<int>>();
+    long sum = 0;
+    std::vector<std::lazy<void>> tasks{};
+    tasks.push_back(sum_values(chan, pipes * per_pipe, sum));
+    for (int i = 0; i < pipes; ++i)
+    {
+        std::array<int, 2> fds{};
+        if (::pipe2(fds.data(), O_NONBLOCK | O_CLOEXEC) < 0)
+        {
+            throw std::system_error(errno, std::generic_category(), "pipe2");
+        }
+        tasks.push_back(pipe_reader(io, fds[0], chan));
+        tasks.push_back(pipe_writer(io, fds[1], i * per_pipe, per_pipe));
+    }
+    for (auto& task : tasks)
+    {
+        task.sync_await();
+    }
+    // One thread multiplexes every pipe into the channel
+    io.run();
+    constexpr long total = pipes * per_pipe;
+    std::cout << (io.backend() == io_backend::uring ? "io_uring" : "epoll")
+              << " pipes sum: " << sum << " (expected " << total * (total - 1) / 2 << ")\n";
+}
+
+auto send_shm(shm_channel<int>& chan, int count) -> std::lazy<void>
+{
+    for (int i = 0; i < count; ++i)
+    {
+        co_await chan.send(i);
+    }
+    chan.close();
+}
+
+auto recv_shm(shm_channel<int>& chan, long& sum) -> std::lazy<void>
+{
+    while (auto value = co_await chan.recv_optional())
+    {
+        sum += *value;
+    }
+}
+
+void shm_processes()
+{
+    constexpr int count = 100'000;
+    shm_channel<int> chan{64};
+    std::cout.flush();
+    const pid_t child = ::fork();
+    if (child < 0)
+    {
+        throw std::system_error(errno, std::generic_category(), "fork");
+    }
+    if (child == 0)
+    {
+        // The child attaches through the inherited fd and sends without an
+        // executor, run_ready() sleeps on the futex while the ring is full
+        auto sender = shm_channel<int>::attach(chan.fd());
+        auto sending = send_shm(sender, count);
+        sending.sync_await();
+        run_ready();
+        std::_Exit(0);
+    }
+    // The parent receives on an executor, parking through the futex
+    long sum = 0;
+    {
+        executor exec{1};
+        exec.spawn(recv_shm(chan, sum));
+        exec.wait();
+    }
+    int status = 0;
+    if (::waitpid(child, &status, 0) < 0)
+    {
+        throw std::system_error(errno, std::generic_category(), "waitpid");
+    }
+    constexpr long expected = static_cast<long>(count) * (count - 1) / 2;
+    std::cout << "shm_channel: " << count << " values from a child process, sum " << sum
+              << " (expected " << expected << ")\n";
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != 0)
+    {
+        throw std::logic_error("shm_channel sender process failed");
+    }
+    if (sum != expected)
+    {
+        throw std::logic_error("shm_channel lost or altered values");
+    }
+}
+
 auto main() -> int
 {
     single_chan();
     std::cout << "==========\n";
     ticktack();
+    std::cout << "==========\n";
+    select_chans();
+    std::cout << "==========\n";
+    batch_chan();
+    std::cout << "==========\n";
+    fan_in();
+    std::cout << "==========\n";
+    pooled_tasks();
+    std::cout << "==========\n";
+    request_channels();
+    std::cout << "==========\n";
+    slab_buffers();
+    std::cout << "==========\n";
+    spill_to_disk_buffer();
+    std::cout << "==========\n";
+    in_place();
+    generators();
+    std::cout << "==========\n";
+    stages();
+    std::cout << "==========\n";
+    broadcasts();
+    std::cout << "==========\n";
+    priorities();
+    std::cout << "==========\n";
+    deadlines();
+    std::cout << "==========\n";
+    sub_queries();
+    std::cout << "==========\n";
+    shed_load();
+    std::cout << "==========\n";
+    pipes(io_backend::uring);
+    pipes(io_backend::epoll);
+    std::cout << "==========\n";
+    shm_processes();
 }
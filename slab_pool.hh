@@ -0,0 +1,204 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <new>
+#include <span>
+#include <utility>
+
+#include "channel.hh"
+#include "ring_buffer.hh"
+
+class slab_pool;
+
+// Owning handle on one slab of a slab_pool, move only. Moving it moves a
+// pointer and a length, never the payload, so channel<slab> transfers buffers
+// between coroutines and threads without copying nor allocating. The slab goes
+// back to its pool when the handle is destroyed.
+class slab
+{
+public:
+    slab() = default;
+
+    slab(slab&& other) noexcept
+        : pool_{std::exchange(other.pool_, nullptr)}
+        , data_{std::exchange(other.data_, nullptr)}
+        , size_{std::exchange(other.size_, 0)}
+    {}
+
+    auto operator=(slab&& other) noexcept -> slab&
+    {
+        if (this != &other)
+        {
+            reset();
+            pool_ = std::exchange(other.pool_, nullptr);
+            data_ = std::exchange(other.data_, nullptr);
+            size_ = std::exchange(other.size_, 0);
+        }
+        return *this;
+    }
+
+    ~slab()
+    {
+        reset();
+    }
+
+    // False for a moved from handle or when the pool was exhausted
+    explicit operator bool() const
+    {
+        return data_ != nullptr;
+    }
+
+    // The whole slab, for the producer to fill before calling resize()
+    [[nodiscard]] auto data() const -> std::span<std::byte>;
+
+    // The bytes written by the producer, what a receiver reads
+    [[nodiscard]] auto view() const -> std::span<const std::byte>
+    {
+        return {data_, size_};
+    }
+
+    [[nodiscard]] auto size() const -> std::size_t
+    {
+        return size_;
+    }
+
+    // size must not exceed the slab size of the pool
+    void resize(std::size_t size)
+    {
+        size_ = size;
+    }
+
+    // Give the slab back to its pool now
+    void reset();
+
+private:
+    friend class slab_pool;
+
+    slab(slab_pool* pool, std::byte* data) : pool_{pool}, data_{data}
+    {}
+
+    slab_pool* pool_ = nullptr;
+    std::byte* data_ = nullptr;
+    std::size_t size_ = 0;
+};
+
+// Fixed number of fixed size slabs allocated once at construction. Slabs are
+// taken and given back through a lock-free stack of indexes whose head carries
+// a version counter against ABA, any thread may release a slab. The pool must
+// outlive every slab taken from it.
+//
+//     slab_pool pool{16 * 1024, 64};
+//     slab_channel<mpmc> chan{8};
+//     auto buffer = pool.try_acquire();
+//     buffer.resize(fill(buffer.data()));
+//     co_await chan.send(std::move(buffer));
+class slab_pool
+{
+public:
+    slab_pool(std::size_t slab_size, std::size_t count)
+        : slab_size_{(slab_size + cache_line_size - 1) / cache_line_size * cache_line_size}
+        , count_{count}
+        , storage_{static_cast<std::byte*>(
+              ::operator new(slab_size_ * count_, std::align_val_t{cache_line_size}))}
+        , next_{std::make_unique<std::atomic<std::uint32_t>[]>(count_)}
+    {
+        for (std::size_t i = 0; i < count_; ++i)
+        {
+            next_[i].store(i + 1 < count_ ? static_cast<std::uint32_t>(i + 1) : none,
+                           std::memory_order_relaxed);
+        }
+        head_.store(count_ == 0 ? none : 0, std::memory_order_relaxed);
+    }
+
+    slab_pool(const slab_pool&) = delete;
+    auto operator=(const slab_pool&) -> slab_pool& = delete;
+
+    ~slab_pool()
+    {
+        ::operator delete(storage_, std::align_val_t{cache_line_size});
+    }
+
+    // Empty handle when every slab is in use
+    [[nodiscard]] auto try_acquire() -> slab
+    {
+        auto head = head_.load(std::memory_order_acquire);
+        while (true)
+        {
+            const auto index = static_cast<std::uint32_t>(head);
+            if (index == none)
+            {
+                return {};
+            }
+            const auto next = next_[index].load(std::memory_order_relaxed);
+            if (head_.compare_exchange_weak(head, bump(head, next), std::memory_order_acquire,
+                                            std::memory_order_acquire))
+            {
+                available_.fetch_sub(1, std::memory_order_relaxed);
+                return slab{this, storage_ + index * slab_size_};
+            }
+        }
+    }
+
+    [[nodiscard]] auto slab_size() const -> std::size_t
+    {
+        return slab_size_;
+    }
+
+    // Slabs not held by any handle, a snapshot when other threads use the pool
+    [[nodiscard]] auto available() const -> std::size_t
+    {
+        return available_.load(std::memory_order_relaxed);
+    }
+
+private:
+    friend class slab;
+
+    static constexpr std::uint32_t none = ~std::uint32_t{0};
+
+    // The upper half of the head counts updates so that a stale compare fails
+    static auto bump(std::uint64_t head, std::uint32_t index) -> std::uint64_t
+    {
+        return ((head >> 32) + 1) << 32 | index;
+    }
+
+    void release(std::byte* data)
+    {
+        const auto index = static_cast<std::uint32_t>((data - storage_) / slab_size_);
+        auto head = head_.load(std::memory_order_relaxed);
+        do
+        {
+            next_[index].store(static_cast<std::uint32_t>(head), std::memory_order_relaxed);
+        } while (!head_.compare_exchange_weak(head, bump(head, index), std::memory_order_release,
+                                              std::memory_order_relaxed));
+        available_.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    const std::size_t slab_size_;
+    const std::size_t count_;
+    std::byte* const storage_;
+    const std::unique_ptr<std::atomic<std::uint32_t>[]> next_;
+    alignas(cache_line_size) std::atomic<std::uint64_t> head_{};
+    std::atomic<std::size_t> available_{count_};
+};
+
+inline auto slab::data() const -> std::span<std::byte>
+{
+    return {data_, pool_ == nullptr ? 0 : pool_->slab_size()};
+}
+
+inline void slab::reset()
+{
+    if (data_ != nullptr)
+    {
+        pool_->release(std::exchange(data_, nullptr));
+        pool_ = nullptr;
+        size_ = 0;
+    }
+}
+
+// Channel moving slab handles, receivers read the payload through view()
+template <typename Policy = single_thread>
+using slab_channel = channel<slab, Policy>;
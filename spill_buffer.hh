@@ -0,0 +1,297 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <cerrno>
+#include <cstddef>
+#include <cstring>
+#include <deque>
+#include <filesystem>
+#include <stdexcept>
+#include <string>
+#include <system_error>
+#include <type_traits>
+#include <utility>
+
+#include <fcntl.h>
+#include <linux/magic.h>
+#include <sys/mman.h>
+#include <sys/vfs.h>
+#include <unistd.h>
+
+#include "channel.hh"
+#include "ring_buffer.hh"
+
+// Directory of the spilled segments: TMPDIR, or /tmp without it. Any type
+// with a static path() can be given instead, naming a disk-backed directory.
+struct temp_spill_directory
+{
+    static auto path() -> std::filesystem::path
+    {
+        return std::filesystem::temp_directory_path();
+    }
+};
+
+// FIFO storage keeping at most MemoryBytes of values in memory. Past that,
+// values are appended to segment files mapped one at a time and read back in
+// order once the memory ring drained, so a stalled consumer costs disk space
+// instead of RSS. Segments are unnamed temporary files in Directory::path(),
+// dropped as soon as they were read. Only the segment being written and the
+// one being read are mapped.
+//
+// The directory must be on disk: a segment in tmpfs or ramfs takes memory all
+// the same, so constructing the buffer throws std::invalid_argument when it is
+// not. It is checked once per Directory, sends never throw it.
+//
+// Values are stored as their bytes, Type must be trivially copyable. Under an
+// mpmc lock a write may page fault on the mapping, waiters spin meanwhile.
+template <typename Type, std::size_t MemoryBytes, typename Directory = temp_spill_directory>
+class spill_ring_buffer
+{
+    static_assert(std::is_trivially_copyable_v<Type>, "values are spilled as raw bytes");
+
+public:
+    explicit spill_ring_buffer(std::size_t capacity)
+        : memory_limit_{std::min(capacity, memory_values)}, memory_{memory_limit_}
+    {
+        directory();
+    }
+
+    spill_ring_buffer(const spill_ring_buffer&) = delete;
+    auto operator=(const spill_ring_buffer&) -> spill_ring_buffer& = delete;
+
+    ~spill_ring_buffer()
+    {
+        for (auto& segment : segments_)
+        {
+            unmap(segment);
+            ::close(segment.fd_);
+        }
+    }
+
+    [[nodiscard]] auto front() -> Type&
+    {
+        if (memory_.empty())
+        {
+            refill();
+        }
+        return memory_.front();
+    }
+
+    void pop_front()
+    {
+        if (memory_.empty())
+        {
+            refill();
+        }
+        memory_.pop_front();
+    }
+
+    // Later values go to disk as long as older ones are there, to keep order
+    template <typename... Args>
+    void emplace_back(Args&&... args)
+    {
+        if (spilled_ == 0 && memory_.size() < memory_limit_)
+        {
+            memory_.emplace_back(std::forward<Args>(args)...);
+            return;
+        }
+        spill(Type(std::forward<Args>(args)...));
+    }
+
+    void push_back(Type&& value)
+    {
+        emplace_back(std::move(value));
+    }
+
+    void push_back(const Type& value)
+    {
+        emplace_back(value);
+    }
+
+    // Move the count oldest values into the already constructed objects at out
+    void move_front(Type* out, std::size_t count)
+    {
+        for (std::size_t i = 0; i < count; ++i)
+        {
+            out[i] = std::move(front());
+            memory_.pop_front();
+        }
+    }
+
+    // Move construct count values from first at the back
+    void push_back_n(Type* first, std::size_t count)
+    {
+        for (std::size_t i = 0; i < count; ++i)
+        {
+            emplace_back(std::move(first[i]));
+        }
+    }
+
+    [[nodiscard]] auto size() const -> std::size_t
+    {
+        return memory_.size() + spilled_;
+    }
+
+    [[nodiscard]] auto empty() const -> bool
+    {
+        return memory_.empty() && spilled_ == 0;
+    }
+
+    // Values currently on disk
+    [[nodiscard]] auto spilled() const -> std::size_t
+    {
+        return spilled_;
+    }
+
+private:
+    static constexpr std::size_t memory_values =
+        std::max<std::size_t>(MemoryBytes / sizeof(Type), 1);
+    static constexpr std::size_t segment_values =
+        std::max<std::size_t>((std::size_t{4} << 20) / sizeof(Type), 1);
+    static constexpr std::size_t segment_bytes = segment_values * sizeof(Type);
+
+    struct segment
+    {
+        int fd_;
+        std::byte* map_ = nullptr;
+        // Values written and read, both grow up to segment_values
+        std::size_t written_ = 0;
+        std::size_t read_ = 0;
+    };
+
+    void spill(const Type& value)
+    {
+        if (segments_.empty() || segments_.back().written_ == segment_values)
+        {
+            if (segments_.size() > 1)
+            {
+                // The reader maps it again when it gets there
+                unmap(segments_.back());
+            }
+            segments_.push_back(segment{create()});
+        }
+        auto& back = segments_.back();
+        map(back);
+        std::memcpy(back.map_ + back.written_ * sizeof(Type), &value, sizeof(Type));
+        ++back.written_;
+        ++spilled_;
+    }
+
+    // Read back as many values as fit in memory, oldest segment first
+    void refill()
+    {
+        while (spilled_ > 0 && memory_.size() < memory_limit_)
+        {
+            auto& front = segments_.front();
+            if (front.map_ == nullptr)
+            {
+                map(front);
+                ::madvise(front.map_, segment_bytes, MADV_SEQUENTIAL);
+            }
+            const auto count =
+                std::min(front.written_ - front.read_, memory_limit_ - memory_.size());
+            for (std::size_t i = 0; i < count; ++i)
+            {
+                std::array<std::byte, sizeof(Type)> bytes;
+                std::memcpy(bytes.data(), front.map_ + (front.read_ + i) * sizeof(Type),
+                            sizeof(Type));
+                memory_.push_back(std::bit_cast<Type>(bytes));
+            }
+            front.read_ += count;
+            spilled_ -= count;
+            if (front.read_ == segment_values)
+            {
+                unmap(front);
+                ::close(front.fd_);
+                segments_.pop_front();
+            }
+        }
+    }
+
+    // Directory::path() once checked to be on disk. A failed check throws
+    // again for the next buffer constructed.
+    static auto directory() -> const std::filesystem::path&
+    {
+        static const std::filesystem::path dir = [] {
+            auto path = Directory::path();
+            struct statfs info{};
+            if (::statfs(path.c_str(), &info) < 0)
+            {
+                throw std::system_error(errno, std::generic_category(), "statfs spill directory");
+            }
+            if (info.f_type == TMPFS_MAGIC || info.f_type == RAMFS_MAGIC)
+            {
+                throw std::invalid_argument("spill directory " + path.string() +
+                                            " is not on disk");
+            }
+            return path;
+        }();
+        return dir;
+    }
+
+    static auto create() -> int
+    {
+        const int fd = ::open(directory().c_str(), O_TMPFILE | O_RDWR | O_CLOEXEC, 0600);
+        if (fd < 0)
+        {
+            throw std::system_error(errno, std::generic_category(), "open spill segment");
+        }
+        if (::ftruncate(fd, static_cast<off_t>(segment_bytes)) < 0)
+        {
+            const int error = errno;
+            ::close(fd);
+            throw std::system_error(error, std::generic_category(), "ftruncate spill segment");
+        }
+        return fd;
+    }
+
+    static void map(segment& segment)
+    {
+        if (segment.map_ != nullptr)
+        {
+            return;
+        }
+        void* map =
+            ::mmap(nullptr, segment_bytes, PROT_READ | PROT_WRITE, MAP_SHARED, segment.fd_, 0);
+        if (map == MAP_FAILED)
+        {
+            throw std::system_error(errno, std::generic_category(), "mmap spill segment");
+        }
+        segment.map_ = static_cast<std::byte*>(map);
+    }
+
+    static void unmap(segment& segment)
+    {
+        if (segment.map_ != nullptr)
+        {
+            ::munmap(segment.map_, segment_bytes);
+            segment.map_ = nullptr;
+        }
+    }
+
+    // ring_buffer rounds its capacity up, the budget is enforced here
+    const std::size_t memory_limit_;
+    ring_buffer<Type> memory_;
+    std::deque<segment> segments_{};
+    std::size_t spilled_ = 0;
+};
+
+// Buffer of a channel spilling to disk past MemoryBytes into Directory, with
+// the locking of Policy. buffer_size still bounds the values buffered, it may
+// be far beyond what fits in memory.
+//
+//     spill_channel<record, 1 << 20> records{1 << 28};
+template <std::size_t MemoryBytes, typename Policy = single_thread,
+          typename Directory = temp_spill_directory>
+struct spill_to_disk
+{
+    using lock_type = typename Policy::lock_type;
+    template <typename Type>
+    using buffer_type = spill_ring_buffer<Type, MemoryBytes, Directory>;
+};
+
+template <typename Type, std::size_t MemoryBytes, typename Policy = single_thread,
+          typename Directory = temp_spill_directory>
+using spill_channel = channel<Type, spill_to_disk<MemoryBytes, Policy, Directory>>;
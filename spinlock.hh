@@ -0,0 +1,73 @@
+#pragma once
+
+#include <atomic>
+#include <thread>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+
+// Lock used by single threaded channels, every operation compiles away.
+class null_lock
+{
+public:
+    void lock() noexcept
+    {}
+    void unlock() noexcept
+    {}
+};
+
+// Test and test-and-set lock for the short critical sections of channel park
+// and wake. Waiters spin on a plain load so the cache line stays shared until
+// the owner releases it.
+class spinlock
+{
+public:
+    void lock() noexcept
+    {
+        while (true)
+        {
+            if (!locked_.exchange(true, std::memory_order_acquire))
+            {
+                return;
+            }
+            for (int spins = 0; locked_.load(std::memory_order_relaxed); ++spins)
+            {
+                if (spins < max_spins)
+                {
+                    pause();
+                }
+                else
+                {
+                    // The owner is likely preempted, give it the core back
+                    std::this_thread::yield();
+                }
+            }
+        }
+    }
+
+    auto try_lock() noexcept -> bool
+    {
+        return !locked_.load(std::memory_order_relaxed) &&
+               !locked_.exchange(true, std::memory_order_acquire);
+    }
+
+    void unlock() noexcept
+    {
+        locked_.store(false, std::memory_order_release);
+    }
+
+private:
+    static void pause() noexcept
+    {
+#if defined(__x86_64__) || defined(__i386__)
+        _mm_pause();
+#elif defined(__aarch64__)
+        asm volatile("yield");
+#endif
+    }
+
+    static constexpr int max_spins = 64;
+
+    std::atomic<bool> locked_{false};
+};
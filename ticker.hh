@@ -0,0 +1,90 @@
+#pragma once
+
+#include "channel.hh"
+#include "executor.hh"
+#include "timer_wheel.hh"
+
+// Channel receiving the current time every period, like Go's time.Ticker.
+// Ticks are dropped while the previous one was not received. The wheel is the
+// one of the thread creating the ticker, or of its executor.
+class ticker : private timer_wheel::entry
+{
+public:
+    using clock = timer_wheel::clock;
+
+    explicit ticker(clock::duration period) : wheel_{timers()}
+    {
+        this->fire_ = &fire;
+        wheel_.arm(*this, clock::now() + period, period);
+    }
+
+    ticker(const ticker&) = delete;
+    auto operator=(const ticker&) -> ticker& = delete;
+
+    ~ticker()
+    {
+        stop();
+    }
+
+    auto chan() -> channel<clock::time_point, mpmc>&
+    {
+        return chan_;
+    }
+
+    // No tick is sent once this returned
+    void stop()
+    {
+        wheel_.cancel(*this);
+    }
+
+private:
+    static void fire(timer_wheel::entry& entry)
+    {
+        static_cast<ticker&>(entry).chan_.try_send(clock::now());
+    }
+
+    timer_wheel& wheel_;
+    channel<clock::time_point, mpmc> chan_{1};
+};
+
+// Channel receiving the current time once the duration elapsed, like Go's
+// time.Timer and time.After.
+class timer : private timer_wheel::entry
+{
+public:
+    using clock = timer_wheel::clock;
+
+    explicit timer(clock::duration duration) : wheel_{timers()}
+    {
+        this->fire_ = &fire;
+        wheel_.arm(*this, clock::now() + duration);
+    }
+
+    timer(const timer&) = delete;
+    auto operator=(const timer&) -> timer& = delete;
+
+    ~timer()
+    {
+        stop();
+    }
+
+    auto chan() -> channel<clock::time_point, mpmc>&
+    {
+        return chan_;
+    }
+
+    // True when the timer was stopped before firing
+    auto stop() -> bool
+    {
+        return wheel_.cancel(*this);
+    }
+
+private:
+    static void fire(timer_wheel::entry& entry)
+    {
+        static_cast<timer&>(entry).chan_.try_send(clock::now());
+    }
+
+    timer_wheel& wheel_;
+    channel<clock::time_point, mpmc> chan_{1};
+};
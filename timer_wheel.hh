@@ -0,0 +1,253 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <mutex>
+#include <thread>
+#include <utility>
+
+#include "spinlock.hh"
+
+// Hierarchical timing wheel: 4 levels of 64 slots with a 1ms tick on the first
+// level, covering about 4.6 hours before a timer has to be cascaded again.
+// Arming and cancelling a timer are O(1), advancing the wheel costs one slot
+// per elapsed tick plus the timers cascaded down or fired.
+class timer_wheel
+{
+public:
+    using clock = std::chrono::steady_clock;
+    static constexpr auto resolution = std::chrono::milliseconds{1};
+
+    // Intrusive timer, owned by the caller and linked in one slot while armed.
+    // fire_ runs outside of the wheel lock on the thread advancing the wheel, a
+    // timer with a period is armed again before it fires.
+    struct entry
+    {
+        void (*fire_)(entry&) = nullptr;
+        std::uint64_t period_ = 0;
+        std::uint64_t expires_ = 0;
+        entry* prev_ = nullptr;
+        entry* next_ = nullptr;
+        entry** head_ = nullptr;
+        entry* fired_ = nullptr;
+        std::atomic<bool> firing_{false};
+    };
+
+    timer_wheel() = default;
+    timer_wheel(const timer_wheel&) = delete;
+    auto operator=(const timer_wheel&) -> timer_wheel& = delete;
+
+    void arm(entry& timer, clock::time_point deadline, clock::duration period = {})
+    {
+        std::lock_guard lock{lock_};
+        timer.period_ = period > clock::duration::zero()
+                            ? std::max<std::uint64_t>(static_cast<std::uint64_t>(period / resolution), 1)
+                            : 0;
+        link(timer, std::max(ticks(deadline), current_ + 1));
+    }
+
+    // True when the timer was still armed, false when it already fired. Once
+    // this returns fire_ is not running and will not run, so the timer may be
+    // destroyed; fire_ must not cancel its own timer.
+    auto cancel(entry& timer) -> bool
+    {
+        bool armed = false;
+        {
+            std::lock_guard lock{lock_};
+            armed = timer.head_ != nullptr;
+            if (armed)
+            {
+                unlink(timer);
+            }
+        }
+        while (timer.firing_.load(std::memory_order_acquire))
+        {
+            std::this_thread::yield();
+        }
+        return armed;
+    }
+
+    [[nodiscard]] auto empty() const -> bool
+    {
+        return armed_.load(std::memory_order_acquire) == 0;
+    }
+
+    // Whether advance(now) may fire a timer, without taking the lock
+    [[nodiscard]] auto due(clock::time_point now = clock::now()) const -> bool
+    {
+        return elapsed_ticks(now) >= next_expiry_.load(std::memory_order_relaxed);
+    }
+
+    // Fire every timer expired at now. Expired timers are collected under the
+    // lock and fired after releasing it, so fire_ may take other locks.
+    void advance(clock::time_point now = clock::now())
+    {
+        entry* fired = nullptr;
+        {
+            std::lock_guard lock{lock_};
+            const auto target = elapsed_ticks(now);
+            while (current_ < target)
+            {
+                if (armed_.load(std::memory_order_relaxed) == 0)
+                {
+                    current_ = target;
+                    break;
+                }
+                ++current_;
+                cascade();
+                auto*& slot = slots_[0][current_ & slot_mask];
+                while (slot != nullptr)
+                {
+                    auto& timer = *slot;
+                    unlink(timer);
+                    if (timer.period_ != 0)
+                    {
+                        link(timer, current_ + timer.period_);
+                    }
+                    if (!timer.firing_.exchange(true, std::memory_order_relaxed))
+                    {
+                        // A periodic timer late by several ticks fires once
+                        timer.fired_ = fired;
+                        fired = &timer;
+                    }
+                }
+            }
+            next_expiry_.store(earliest(), std::memory_order_relaxed);
+        }
+        while (fired != nullptr)
+        {
+            auto& timer = *fired;
+            fired = timer.fired_;
+            timer.fire_(timer);
+            timer.firing_.store(false, std::memory_order_release);
+        }
+    }
+
+private:
+    static constexpr std::size_t levels = 4;
+    static constexpr std::size_t slot_bits = 6;
+    static constexpr std::size_t slot_count = std::size_t{1} << slot_bits;
+    static constexpr std::uint64_t slot_mask = slot_count - 1;
+    static constexpr std::uint64_t never = std::numeric_limits<std::uint64_t>::max();
+
+    auto ticks(clock::time_point time) const -> std::uint64_t
+    {
+        if (time <= start_)
+        {
+            return 0;
+        }
+        // Round up, a timer never fires before its deadline
+        const auto elapsed = time - start_;
+        return static_cast<std::uint64_t>((elapsed + resolution - clock::duration{1}) / resolution);
+    }
+
+    // Ticks fully elapsed at now, rounded down for the same reason
+    auto elapsed_ticks(clock::time_point now) const -> std::uint64_t
+    {
+        return now <= start_ ? 0 : static_cast<std::uint64_t>((now - start_) / resolution);
+    }
+
+    // Lower bound of the next expiry: a timer of the first level is exact,
+    // those of the other levels cannot expire before the next first level
+    // wrap cascades them
+    auto earliest() const -> std::uint64_t
+    {
+        if (armed_.load(std::memory_order_relaxed) == 0)
+        {
+            return never;
+        }
+        const std::uint64_t wrap = (current_ | slot_mask) + 1;
+        for (auto tick = current_ + 1; tick < wrap; ++tick)
+        {
+            if (slots_[0][tick & slot_mask] != nullptr)
+            {
+                return tick;
+            }
+        }
+        return wrap;
+    }
+
+    void link(entry& timer, std::uint64_t expires)
+    {
+        timer.expires_ = expires;
+        if (expires < next_expiry_.load(std::memory_order_relaxed))
+        {
+            next_expiry_.store(expires, std::memory_order_relaxed);
+        }
+        const auto delta = expires - current_;
+        std::size_t level = 0;
+        while (level + 1 < levels && delta >= (std::uint64_t{1} << (slot_bits * (level + 1))))
+        {
+            ++level;
+        }
+        // Timers past the last level wait in its farthest slot and get placed
+        // again when it is cascaded
+        const bool beyond = delta >= (std::uint64_t{1} << (slot_bits * levels));
+        const auto index = beyond ? (current_ >> (slot_bits * level)) - 1
+                                  : expires >> (slot_bits * level);
+        auto*& head = slots_[level][index & slot_mask];
+        timer.prev_ = nullptr;
+        timer.next_ = head;
+        if (head != nullptr)
+        {
+            head->prev_ = &timer;
+        }
+        head = &timer;
+        timer.head_ = &head;
+        armed_.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    void unlink(entry& timer)
+    {
+        if (timer.prev_ != nullptr)
+        {
+            timer.prev_->next_ = timer.next_;
+        }
+        else
+        {
+            *timer.head_ = timer.next_;
+        }
+        if (timer.next_ != nullptr)
+        {
+            timer.next_->prev_ = timer.prev_;
+        }
+        timer.prev_ = nullptr;
+        timer.next_ = nullptr;
+        timer.head_ = nullptr;
+        armed_.fetch_sub(1, std::memory_order_relaxed);
+    }
+
+    // Entering a new slot of a level moves its timers down to finer levels
+    void cascade()
+    {
+        for (std::size_t level = 1; level < levels; ++level)
+        {
+            if ((current_ & ((std::uint64_t{1} << (slot_bits * level)) - 1)) != 0)
+            {
+                return;
+            }
+            auto*& slot = slots_[level][(current_ >> (slot_bits * level)) & slot_mask];
+            auto* timer = std::exchange(slot, nullptr);
+            while (timer != nullptr)
+            {
+                auto* next = timer->next_;
+                armed_.fetch_sub(1, std::memory_order_relaxed);
+                link(*timer, timer->expires_);
+                timer = next;
+            }
+        }
+    }
+
+    const clock::time_point start_ = clock::now();
+    std::uint64_t current_ = 0;
+    std::array<std::array<entry*, slot_count>, levels> slots_{};
+    std::atomic<std::size_t> armed_{0};
+    // Written under the lock, read without it by due()
+    std::atomic<std::uint64_t> next_expiry_{never};
+    spinlock lock_{};
+};
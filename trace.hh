@@ -0,0 +1,224 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <fstream>
+#include <mutex>
+#include <ostream>
+#include <string_view>
+#include <vector>
+
+// Events emitted by lazy tasks and channels. The sink is chosen at compile
+// time, see TRACE_SINK in CMakeLists.txt:
+//   none    every trace() call compiles away (default)
+//   ring    records kept in a per thread ring, read back with
+//           ring_trace_sink::records()
+//   chrome  ring, dumped as Chrome trace-event JSON to TRACE_FILE at exit
+enum class trace_event : std::uint8_t
+{
+    lazy_start,
+    lazy_finish,
+    park,
+    wake,
+    handoff,
+    close,
+};
+
+inline auto to_string(trace_event event) -> std::string_view
+{
+    switch (event)
+    {
+    case trace_event::lazy_start:
+        return "lazy_start";
+    case trace_event::lazy_finish:
+        return "lazy_finish";
+    case trace_event::park:
+        return "park";
+    case trace_event::wake:
+        return "wake";
+    case trace_event::handoff:
+        return "handoff";
+    case trace_event::close:
+        return "close";
+    }
+    return "unknown";
+}
+
+struct trace_record
+{
+    std::uint64_t time_ns = 0;
+    // Channel or lazy frame the event is about
+    const void* object = nullptr;
+    // Coroutine parked, woken or started
+    const void* coroutine = nullptr;
+    std::uint32_t thread = 0;
+    trace_event event = trace_event::lazy_start;
+};
+
+struct null_trace_sink
+{
+    static constexpr bool enabled = false;
+
+    static void emit(trace_event /*event*/, const void* /*object*/,
+                     const void* /*coroutine*/) noexcept
+    {}
+};
+
+// Every thread writes to its own ring without synchronization, the oldest
+// records are overwritten. Rings outlive their thread so that the records of
+// executor workers can be read after the pool stopped.
+struct ring_trace_sink
+{
+    static constexpr bool enabled = true;
+    static constexpr std::size_t ring_size = 4096;
+
+    struct ring
+    {
+        std::array<trace_record, ring_size> records_{};
+        std::atomic<std::size_t> head_{0};
+        std::uint32_t thread_ = 0;
+    };
+
+    static void emit(trace_event event, const void* object, const void* coroutine) noexcept
+    {
+        auto& self = local();
+        const auto head = self.head_.load(std::memory_order_relaxed);
+        self.records_[head % ring_size] = trace_record{now(), object, coroutine, self.thread_, event};
+        self.head_.store(head + 1, std::memory_order_release);
+    }
+
+    // Records of every thread ordered by time. Only consistent once the
+    // traced threads are quiescent.
+    static auto records() -> std::vector<trace_record>
+    {
+        std::vector<trace_record> all{};
+        auto& rings = registry();
+        std::lock_guard lock{rings.lock_};
+        for (const auto* ring : rings.rings_)
+        {
+            const auto head = ring->head_.load(std::memory_order_acquire);
+            for (auto i = head > ring_size ? head - ring_size : 0; i < head; ++i)
+            {
+                all.push_back(ring->records_[i % ring_size]);
+            }
+        }
+        std::stable_sort(all.begin(), all.end(),
+                         [](const auto& lhs, const auto& rhs) { return lhs.time_ns < rhs.time_ns; });
+        return all;
+    }
+
+private:
+    struct ring_registry
+    {
+        std::mutex lock_{};
+        std::vector<ring*> rings_{};
+    };
+
+    static auto registry() -> ring_registry&
+    {
+        // Leaked on purpose, like the rings it points to
+        static auto* rings = new ring_registry{};
+        return *rings;
+    }
+
+    static auto local() -> ring&
+    {
+        thread_local ring* self = [] {
+            auto& rings = registry();
+            std::lock_guard lock{rings.lock_};
+            auto* created = new ring{};
+            created->thread_ = static_cast<std::uint32_t>(rings.rings_.size());
+            rings.rings_.push_back(created);
+            return created;
+        }();
+        return *self;
+    }
+
+    static auto now() noexcept -> std::uint64_t
+    {
+        return static_cast<std::uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+                                              std::chrono::steady_clock::now().time_since_epoch())
+                                              .count());
+    }
+};
+
+// Write records as Chrome trace-event JSON, loadable in about:tracing or
+// Perfetto. A lazy task is an async slice keyed by its frame, channel events
+// are instants.
+inline void write_chrome_trace(std::ostream& out, const std::vector<trace_record>& records)
+{
+    out << "{\"traceEvents\":[";
+    const char* separator = "\n";
+    for (const auto& record : records)
+    {
+        out << separator << "{\"ts\":" << static_cast<double>(record.time_ns) / 1000.0
+            << ",\"pid\":1,\"tid\":" << record.thread;
+        switch (record.event)
+        {
+        case trace_event::lazy_start:
+        case trace_event::lazy_finish:
+            out << ",\"name\":\"lazy\",\"cat\":\"lazy\",\"ph\":\""
+                << (record.event == trace_event::lazy_start ? 'b' : 'e') << "\",\"id\":\""
+                << record.object << "\"";
+            break;
+        default:
+            out << ",\"name\":\"" << to_string(record.event)
+                << "\",\"cat\":\"channel\",\"ph\":\"i\",\"s\":\"t\",\"args\":{\"channel\":\""
+                << record.object << "\",\"coroutine\":\"" << record.coroutine << "\"}";
+            break;
+        }
+        out << "}";
+        separator = ",\n";
+    }
+    out << "\n]}\n";
+}
+
+#ifndef TRACE_FILE
+#define TRACE_FILE "trace.json"
+#endif
+
+// Ring sink writing every record to TRACE_FILE when the program exits
+struct chrome_trace_sink
+{
+    static constexpr bool enabled = true;
+
+    static void emit(trace_event event, const void* object, const void* coroutine) noexcept
+    {
+        static const flush_at_exit flush{};
+        ring_trace_sink::emit(event, object, coroutine);
+    }
+
+private:
+    struct flush_at_exit
+    {
+        flush_at_exit() = default;
+        flush_at_exit(const flush_at_exit&) = delete;
+        auto operator=(const flush_at_exit&) -> flush_at_exit& = delete;
+
+        ~flush_at_exit()
+        {
+            std::ofstream out{TRACE_FILE};
+            write_chrome_trace(out, ring_trace_sink::records());
+        }
+    };
+};
+
+#if defined(TRACE_SINK_CHROME)
+using trace_sink = chrome_trace_sink;
+#elif defined(TRACE_SINK_RING)
+using trace_sink = ring_trace_sink;
+#else
+using trace_sink = null_trace_sink;
+#endif
+
+inline void trace(trace_event event, const void* object, const void* coroutine = nullptr) noexcept
+{
+    if constexpr (trace_sink::enabled)
+    {
+        trace_sink::emit(event, object, coroutine);
+    }
+}
@@ -0,0 +1,232 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <initializer_list>
+#include <memory>
+#include <system_error>
+#include <utility>
+
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+// Minimal io_uring over the raw syscalls, liburing is not required. Entries
+// are queued by prepare() and only handed to the kernel by submit(), so every
+// operation prepared during one pass of the run loop costs a single
+// io_uring_enter together with the wait for completions.
+class uring
+{
+public:
+    explicit uring(unsigned entries)
+    {
+        io_uring_params params{};
+        fd_ = static_cast<int>(::syscall(__NR_io_uring_setup, entries, &params));
+        if (fd_ < 0)
+        {
+            throw std::system_error(errno, std::generic_category(), "io_uring_setup");
+        }
+        try
+        {
+            map(params);
+            probe({IORING_OP_READ, IORING_OP_WRITE, IORING_OP_ACCEPT, IORING_OP_POLL_ADD,
+                   IORING_OP_TIMEOUT});
+        }
+        catch (...)
+        {
+            unmap();
+            ::close(fd_);
+            throw;
+        }
+    }
+
+    uring(const uring&) = delete;
+    auto operator=(const uring&) -> uring& = delete;
+
+    ~uring()
+    {
+        unmap();
+        ::close(fd_);
+    }
+
+    // Next free submission entry, zeroed. When the ring is full the queued
+    // entries are submitted first; while the kernel refuses them because the
+    // completion queue is full, completions are reaped into complete(user_data,
+    // res) to make room, and the error is thrown when there is none to reap.
+    template <typename Complete>
+    auto prepare(Complete&& complete) -> io_uring_sqe&
+    {
+        while (sqe_tail_ - load_acquire(sq_head_) >= sq_entries_)
+        {
+            const int error = enter(0);
+            if (error != 0 && error != EINTR && reap(complete) == 0)
+            {
+                throw std::system_error(error, std::generic_category(), "io_uring_enter");
+            }
+        }
+        const auto index = sqe_tail_ & sq_mask_;
+        auto& sqe = sqes_[index];
+        std::memset(&sqe, 0, sizeof(sqe));
+        sq_array_[index] = index;
+        ++sqe_tail_;
+        return sqe;
+    }
+
+    // Hand the prepared entries to the kernel and wait for at least wait
+    // completions. Returns false when interrupted before that.
+    auto submit(unsigned wait) -> bool
+    {
+        const int error = enter(wait);
+        if (error == EINTR || error == EAGAIN || error == EBUSY)
+        {
+            return false;
+        }
+        if (error != 0)
+        {
+            throw std::system_error(error, std::generic_category(), "io_uring_enter");
+        }
+        return true;
+    }
+
+    // Call func(user_data, res) for every completion available
+    template <typename Func>
+    auto reap(Func&& func) -> std::size_t
+    {
+        auto head = *cq_head_;
+        const auto tail = load_acquire(cq_tail_);
+        const std::size_t count = tail - head;
+        for (; head != tail; ++head)
+        {
+            const auto& cqe = cqes_[head & cq_mask_];
+            func(cqe.user_data, cqe.res);
+        }
+        store_release(cq_head_, head);
+        return count;
+    }
+
+private:
+    // Submit and wait like submit(), returning 0 or the errno
+    auto enter(unsigned wait) -> int
+    {
+        store_release(sq_tail_, sqe_tail_);
+        const unsigned pending = sqe_tail_ - submitted_;
+        const auto flags = wait > 0 ? IORING_ENTER_GETEVENTS : 0U;
+        const auto ret = ::syscall(__NR_io_uring_enter, fd_, pending, wait, flags, nullptr, 0);
+        if (ret < 0)
+        {
+            return errno;
+        }
+        submitted_ += static_cast<unsigned>(ret);
+        return 0;
+    }
+
+    static auto load_acquire(unsigned* value) -> unsigned
+    {
+        return std::atomic_ref<unsigned>{*value}.load(std::memory_order_acquire);
+    }
+
+    static void store_release(unsigned* value, unsigned desired)
+    {
+        std::atomic_ref<unsigned>{*value}.store(desired, std::memory_order_release);
+    }
+
+    static auto mmap_ring(int fd, std::size_t size, off_t offset) -> void*
+    {
+        void* ptr = ::mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd,
+                           offset);
+        if (ptr == MAP_FAILED)
+        {
+            throw std::system_error(errno, std::generic_category(), "mmap io_uring");
+        }
+        return ptr;
+    }
+
+    void map(const io_uring_params& params)
+    {
+        sq_size_ = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+        cq_size_ = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+        const bool single = (params.features & IORING_FEAT_SINGLE_MMAP) != 0U;
+        if (single)
+        {
+            sq_size_ = cq_size_ = std::max(sq_size_, cq_size_);
+        }
+        sq_ring_ = mmap_ring(fd_, sq_size_, IORING_OFF_SQ_RING);
+        cq_ring_ = single ? sq_ring_ : mmap_ring(fd_, cq_size_, IORING_OFF_CQ_RING);
+        sqes_size_ = params.sq_entries * sizeof(io_uring_sqe);
+        sqes_ = static_cast<io_uring_sqe*>(mmap_ring(fd_, sqes_size_, IORING_OFF_SQES));
+
+        auto* sq = static_cast<std::byte*>(sq_ring_);
+        sq_head_ = reinterpret_cast<unsigned*>(sq + params.sq_off.head);
+        sq_tail_ = reinterpret_cast<unsigned*>(sq + params.sq_off.tail);
+        sq_mask_ = *reinterpret_cast<unsigned*>(sq + params.sq_off.ring_mask);
+        sq_entries_ = *reinterpret_cast<unsigned*>(sq + params.sq_off.ring_entries);
+        sq_array_ = reinterpret_cast<unsigned*>(sq + params.sq_off.array);
+        sqe_tail_ = submitted_ = *sq_tail_;
+
+        auto* cq = static_cast<std::byte*>(cq_ring_);
+        cq_head_ = reinterpret_cast<unsigned*>(cq + params.cq_off.head);
+        cq_tail_ = reinterpret_cast<unsigned*>(cq + params.cq_off.tail);
+        cq_mask_ = *reinterpret_cast<unsigned*>(cq + params.cq_off.ring_mask);
+        cqes_ = reinterpret_cast<io_uring_cqe*>(cq + params.cq_off.cqes);
+    }
+
+    void unmap()
+    {
+        if (sqes_ != nullptr)
+        {
+            ::munmap(sqes_, sqes_size_);
+        }
+        if (cq_ring_ != nullptr && cq_ring_ != sq_ring_)
+        {
+            ::munmap(cq_ring_, cq_size_);
+        }
+        if (sq_ring_ != nullptr)
+        {
+            ::munmap(sq_ring_, sq_size_);
+        }
+    }
+
+    // Older kernels lack some opcodes, better fall back than fail at runtime
+    void probe(std::initializer_list<int> ops)
+    {
+        constexpr std::size_t probed = 256;
+        const std::size_t size = sizeof(io_uring_probe) + probed * sizeof(io_uring_probe_op);
+        auto buffer = std::make_unique<std::byte[]>(size);
+        auto* result = reinterpret_cast<io_uring_probe*>(buffer.get());
+        if (::syscall(__NR_io_uring_register, fd_, IORING_REGISTER_PROBE, result, probed) < 0)
+        {
+            throw std::system_error(errno, std::generic_category(), "io_uring probe");
+        }
+        for (const int op : ops)
+        {
+            if (op > result->last_op || (result->ops[op].flags & IO_URING_OP_SUPPORTED) == 0)
+            {
+                throw std::system_error(ENOSYS, std::generic_category(), "io_uring opcode");
+            }
+        }
+    }
+
+    int fd_ = -1;
+    void* sq_ring_ = nullptr;
+    void* cq_ring_ = nullptr;
+    std::size_t sq_size_ = 0;
+    std::size_t cq_size_ = 0;
+    std::size_t sqes_size_ = 0;
+    io_uring_sqe* sqes_ = nullptr;
+    unsigned* sq_head_ = nullptr;
+    unsigned* sq_tail_ = nullptr;
+    unsigned* sq_array_ = nullptr;
+    unsigned sq_mask_ = 0;
+    unsigned sq_entries_ = 0;
+    unsigned sqe_tail_ = 0;
+    unsigned submitted_ = 0;
+    unsigned* cq_head_ = nullptr;
+    unsigned* cq_tail_ = nullptr;
+    unsigned cq_mask_ = 0;
+    io_uring_cqe* cqes_ = nullptr;
+};
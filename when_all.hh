@@ -0,0 +1,288 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <coroutine>
+#include <cstddef>
+#include <exception>
+#include <memory>
+#include <optional>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+#include <variant>
+
+#include "executor.hh"
+#include "frame_pool.hh"
+#include "lazy.hh"
+
+template <typename Task>
+inline constexpr bool is_lazy = false;
+template <typename Type, typename Allocator>
+inline constexpr bool is_lazy<std::lazy<Type, Allocator>> = true;
+
+template <typename Task>
+struct lazy_result;
+template <typename Type, typename Allocator>
+struct lazy_result<std::lazy<Type, Allocator>>
+{
+    using type = Type;
+};
+
+// Result of a child, void ones complete with an empty value
+template <typename Task>
+using when_value = std::conditional_t<std::is_void_v<typename lazy_result<Task>::type>,
+                                      std::monostate, typename lazy_result<Task>::type>;
+
+// Coroutine driving one child of when_all/when_any. Its frame comes from the
+// frame_pool and destroys itself once done, transferring to the coroutine its
+// body picked: the parent for the child completing it, otherwise the next
+// ready one.
+struct when_runner
+{
+    struct promise_type
+    {
+        static auto operator new(std::size_t size) -> void*
+        {
+            return frame_pool::allocate(size);
+        }
+        static void operator delete(void* ptr) noexcept
+        {
+            frame_pool::deallocate(ptr);
+        }
+
+        auto get_return_object() -> when_runner
+        {
+            return {std::coroutine_handle<promise_type>::from_promise(*this)};
+        }
+        auto initial_suspend() -> std::suspend_always
+        {
+            return {};
+        }
+
+        struct final_awaiter
+        {
+            [[nodiscard]] auto await_ready() noexcept -> bool
+            {
+                return false;
+            }
+            auto await_suspend(std::coroutine_handle<promise_type> handle) noexcept
+                -> std::coroutine_handle<>
+            {
+                auto next = handle.promise().next_;
+                handle.destroy();
+                return next;
+            }
+            void await_resume() noexcept
+            {}
+        };
+        auto final_suspend() noexcept -> final_awaiter
+        {
+            return {};
+        }
+
+        void return_value(std::coroutine_handle<> next)
+        {
+            next_ = next;
+        }
+        void unhandled_exception()
+        {
+            std::terminate();
+        }
+
+        std::coroutine_handle<> next_{};
+    };
+
+    std::coroutine_handle<promise_type> handle_;
+};
+
+// Run the first runner right away and the others from the run queue, where
+// the workers of an executor steal them. Only the local handles are touched
+// after the first schedule, a child may complete the awaiter concurrently.
+template <std::size_t Count>
+auto start_runners(const std::array<std::coroutine_handle<>, Count>& runners)
+    -> std::coroutine_handle<>
+{
+    for (std::size_t i = 1; i < Count; ++i)
+    {
+        schedule(runners[i]);
+    }
+    return runners[0];
+}
+
+// Start every child at once and resume with the tuple of their results once
+// the last one completed. Results live in the awaiter, so in the frame of the
+// awaiting coroutine. The first exception thrown by a child is rethrown once
+// they all completed.
+//
+//     auto [user, orders] = co_await when_all(fetch_user(id), fetch_orders(id));
+template <typename... Tasks>
+class [[nodiscard]] when_all_awaiter
+{
+public:
+    explicit when_all_awaiter(Tasks... tasks) : tasks_{std::move(tasks)...}
+    {}
+
+    [[nodiscard]] auto await_ready() const noexcept -> bool
+    {
+        return sizeof...(Tasks) == 0;
+    }
+    auto await_suspend(std::coroutine_handle<> parent) -> std::coroutine_handle<>
+    {
+        parent_ = parent;
+        return start_runners(make_runners(std::index_sequence_for<Tasks...>{}));
+    }
+    auto await_resume() -> std::tuple<when_value<Tasks>...>
+    {
+        for (auto& exception : exceptions_)
+        {
+            if (exception)
+            {
+                std::rethrow_exception(exception);
+            }
+        }
+        return std::apply([](auto&... results) { return std::make_tuple(std::move(*results)...); },
+                          results_);
+    }
+
+private:
+    template <std::size_t... Index>
+    auto make_runners(std::index_sequence<Index...>)
+        -> std::array<std::coroutine_handle<>, sizeof...(Tasks)>
+    {
+        return {run<Index>(std::move(std::get<Index>(tasks_)), *this).handle_...};
+    }
+
+    template <std::size_t Index, typename Type, typename Allocator>
+    static auto run(std::lazy<Type, Allocator> task, when_all_awaiter& self) -> when_runner
+    {
+        try
+        {
+            if constexpr (std::is_void_v<Type>)
+            {
+                co_await std::move(task);
+                std::get<Index>(self.results_).emplace();
+            }
+            else
+            {
+                std::get<Index>(self.results_).emplace(co_await std::move(task));
+            }
+        }
+        catch (...)
+        {
+            self.exceptions_[Index] = std::current_exception();
+        }
+        // self may be gone as soon as the count dropped, unless it hit zero
+        if (self.left_.fetch_sub(1, std::memory_order_acq_rel) == 1)
+        {
+            co_return self.parent_;
+        }
+        co_return next_ready();
+    }
+
+    std::tuple<Tasks...> tasks_;
+    std::tuple<std::optional<when_value<Tasks>>...> results_{};
+    std::array<std::exception_ptr, sizeof...(Tasks)> exceptions_{};
+    std::atomic<std::size_t> left_{sizeof...(Tasks)};
+    std::coroutine_handle<> parent_{};
+};
+
+template <typename... Tasks>
+    requires(is_lazy<Tasks> && ...)
+auto when_all(Tasks... tasks) -> when_all_awaiter<Tasks...>
+{
+    return when_all_awaiter<Tasks...>{std::move(tasks)...};
+}
+
+// Start every child at once and resume with the result of the first one to
+// complete, as the alternative of the variant at its index. The others run to
+// completion in the background and their results are dropped: give them a
+// stop_token to cut them short, and keep what they reference alive until they
+// are done. Only the winner touches the awaiter, the others a shared flag.
+//
+//     auto first = co_await when_any(query(primary), query(replica));
+template <typename... Tasks>
+class [[nodiscard]] when_any_awaiter
+{
+    static_assert(sizeof...(Tasks) > 0, "when_any needs at least one task");
+
+public:
+    explicit when_any_awaiter(Tasks... tasks) : tasks_{std::move(tasks)...}
+    {}
+
+    [[nodiscard]] auto await_ready() const noexcept -> bool
+    {
+        return false;
+    }
+    auto await_suspend(std::coroutine_handle<> parent) -> std::coroutine_handle<>
+    {
+        parent_ = parent;
+        auto won = std::allocate_shared<std::atomic<bool>>(frame_allocator<std::byte>{}, false);
+        return start_runners(make_runners(std::move(won), std::index_sequence_for<Tasks...>{}));
+    }
+    auto await_resume() -> std::variant<when_value<Tasks>...>
+    {
+        if (exception_)
+        {
+            std::rethrow_exception(exception_);
+        }
+        return std::move(*result_);
+    }
+
+private:
+    template <std::size_t... Index>
+    auto make_runners(std::shared_ptr<std::atomic<bool>> won, std::index_sequence<Index...>)
+        -> std::array<std::coroutine_handle<>, sizeof...(Tasks)>
+    {
+        return {run<Index>(std::move(std::get<Index>(tasks_)), this, won).handle_...};
+    }
+
+    template <std::size_t Index, typename Type, typename Allocator>
+    static auto run(std::lazy<Type, Allocator> task, when_any_awaiter* self,
+                    std::shared_ptr<std::atomic<bool>> won) -> when_runner
+    {
+        std::optional<when_value<std::lazy<Type, Allocator>>> result{};
+        std::exception_ptr exception{};
+        try
+        {
+            if constexpr (std::is_void_v<Type>)
+            {
+                co_await std::move(task);
+                result.emplace();
+            }
+            else
+            {
+                result.emplace(co_await std::move(task));
+            }
+        }
+        catch (...)
+        {
+            exception = std::current_exception();
+        }
+        if (won->exchange(true, std::memory_order_acq_rel))
+        {
+            co_return next_ready();
+        }
+        if (exception)
+        {
+            self->exception_ = std::move(exception);
+        }
+        else
+        {
+            self->result_.emplace(std::in_place_index<Index>, std::move(*result));
+        }
+        co_return self->parent_;
+    }
+
+    std::tuple<Tasks...> tasks_;
+    std::optional<std::variant<when_value<Tasks>...>> result_{};
+    std::exception_ptr exception_{};
+    std::coroutine_handle<> parent_{};
+};
+
+template <typename... Tasks>
+    requires(is_lazy<Tasks> && ...)
+auto when_any(Tasks... tasks) -> when_any_awaiter<Tasks...>
+{
+    return when_any_awaiter<Tasks...>{std::move(tasks)...};
+}